@@ -61,7 +61,9 @@
         '../src/lib/corpus-io.cpp',
         '../src/lib/dictionary.cpp',
         '../src/lib/feature-io.cpp',
+        '../src/lib/feature-kernels.cpp',
         '../src/lib/feature-lookup.cpp',
+        '../src/lib/feature-shard.cpp',
         '../src/lib/general-io.cpp',
         '../src/lib/kytea-config.cpp',
         '../src/lib/kytea-lm.cpp',
@@ -70,6 +72,7 @@
         '../src/lib/kytea-struct.cpp',
         '../src/lib/kytea-util.cpp',
         '../src/lib/kytea.cpp',
+        '../src/lib/mapped-file.cpp',
         '../src/lib/model-io.cpp',
         '../src/lib/string-util.cpp',
         '../src/lib/liblinear/linear.cpp',
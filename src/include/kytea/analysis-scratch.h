@@ -0,0 +1,90 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef KYTEA_ANALYSIS_SCRATCH_H_
+#define KYTEA_ANALYSIS_SCRATCH_H_
+
+#include <kytea/feature-vector.h>
+#include <kytea/kytea-lm.h>
+#include <vector>
+#include <string>
+
+namespace kytea  {
+
+// A node of the lattice that is searched for the tags of an unknown word,
+// which adds one subword tag to the node "back" (0 is the start node)
+class UnkTagNode {
+public:
+    unsigned back;
+    const KyteaString * tag;
+    double score;
+    // the state of the LM after the tag
+    KyteaLMState state;
+    // the length of the tag string up to this node
+    unsigned length;
+
+    UnkTagNode(unsigned b, const KyteaString * t, double s, KyteaLMState st, unsigned l) :
+        back(b), tag(t), score(s), state(st), length(l) { }
+};
+
+// Buffers for the temporary values that are used while analyzing a sentence.
+// Every thread has its own scratch space (see get()), which is reset at the
+// start of each sentence. The buffers keep their capacity when they are
+// reset, so once they have grown to fit the longest sentence seen by a thread
+// analysis no longer allocates memory for them.
+class AnalysisScratch {
+
+public:
+
+    // The word segmentation score of each boundary
+    std::vector<FeatSum> wsScores;
+    // The tagging score of each candidate tag
+    std::vector<FeatSum> tagScores;
+    // The dictionary features that are active in the sentence
+    std::vector<unsigned> dictFeats;
+    // The character types of the sentence
+    std::string typeStr;
+    // The character types of the sentence as a KyteaString (typeChars), and
+    //  the string and the serial number of the StringUtil that they were
+    //  found for (0 if they have not been found for this sentence)
+    KyteaString typeNorm, typeChars;
+    unsigned long typeUtil;
+    // The lattice of the unknown word search, and the nodes that end at
+    //  each character of the word
+    std::vector<UnkTagNode> unkNodes;
+    std::vector< std::vector<unsigned> > unkStacks;
+
+    AnalysisScratch() : typeUtil(0) { }
+
+    void reset() {
+        wsScores.clear();
+        tagScores.clear();
+        dictFeats.clear();
+        typeStr.clear();
+        typeUtil = 0;
+    }
+
+    // Get the scratch space of the current thread
+    static AnalysisScratch & get() {
+        static thread_local AnalysisScratch scratch;
+        return scratch;
+    }
+
+};
+
+}
+
+#endif
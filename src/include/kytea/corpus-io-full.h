@@ -12,6 +12,11 @@ protected:
 
     bool allTags_;
     KyteaString bounds_;
+    // the bounds as strings, set when they are first written
+    std::vector<std::string> boundStrs_;
+
+    // append the words and tags of a sentence, followed by a newline
+    void appendWords(const KyteaSentence * sent);
     bool printWords_;
 
 public:
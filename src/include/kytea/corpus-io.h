@@ -36,11 +36,38 @@ protected:
     int numTags_;
     std::vector<bool> doTag_;
 
+    // Sentences are formatted into this buffer, which is written to the
+    // stream with a single call once it is large enough (or after every
+    // sentence if flushEach_ is set)
+    std::string outBuff_;
+    bool flushEach_;
+    const static size_t OUT_BUFFER_SIZE = 1 << 16;
+
+    // Append a number to the buffer in the same format as the stream
+    void appendNumber(double val);
+    void appendNumber(int val);
+    // Call at the end of each sentence
+    void finishSentence() {
+        if(flushEach_ || outBuff_.size() >= OUT_BUFFER_SIZE)
+            flush();
+    }
+
+    // Input is read through this, which is created on the first read
+    LineReader * reader_;
+
+    // Read a line from the stream, returning false at the end of the stream
+    // (see LineReader::readLine)
+    bool readLine(const char *& line, size_t & len);
+    bool readLine(std::string & line);
+
 public:
 
-    CorpusIO(StringUtil * util) : GeneralIO(util), unkTag_(), numTags_(0), doTag_() { }
-    CorpusIO(StringUtil * util, const char* file, bool out) : GeneralIO(util,file,out,false), numTags_(0), doTag_() { } 
-    CorpusIO(StringUtil * util, std::iostream & str, bool out) : GeneralIO(util,str,out,false), numTags_(0), doTag_() { }
+    CorpusIO(StringUtil * util) : GeneralIO(util), unkTag_(), numTags_(0), doTag_(), flushEach_(true), reader_(0) { }
+    CorpusIO(StringUtil * util, const char* file, bool out) : GeneralIO(util,file,out,false), numTags_(0), doTag_(), flushEach_(true), reader_(0) { } 
+    CorpusIO(StringUtil * util, std::iostream & str, bool out) : GeneralIO(util,str,out,false), numTags_(0), doTag_(), flushEach_(true), reader_(0) { }
+    // buffered input and output stay with the original
+    CorpusIO(const CorpusIO & c) : GeneralIO(c), unkTag_(c.unkTag_), numTags_(c.numTags_), doTag_(c.doTag_), flushEach_(c.flushEach_), reader_(0) { }
+    CorpusIO & operator=(const CorpusIO &) = delete;
 
     int getNumTags() { return numTags_; }
     void setNumTags(int numTags) { numTags_ = numTags; }
@@ -50,7 +77,17 @@ public:
     }
     bool getDoTag(int i) { return i >= (int)doTag_.size() || doTag_[i]; }
 
-    virtual ~CorpusIO() { }
+    virtual ~CorpusIO() {
+        flush();
+        if(reader_) delete reader_;
+    }
+
+    // Write the buffered output to the stream and flush it
+    void flush();
+    // If true (the default), the output of every sentence is flushed at once,
+    // so a process that reads it interactively will see it. Otherwise the
+    // output is written in large blocks.
+    void setFlushEach(bool flushEach) { flushEach_ = flushEach; }
 
     // create an appropriate parser based on the type
     static CorpusIO* createIO(const char* file, CorpusFormat form, const KyteaConfig & conf, bool output, StringUtil* util);
@@ -19,9 +19,14 @@
 
 #include <kytea/kytea-string.h>
 #include <kytea/string-util.h>
+#include <kytea/kytea-util.h>
+#include <kytea/feature-vector.h>
+#include <kytea/mapped-file.h>
 // #include <kytea/kytea-model.h>
 #include <map>
 #include <deque>
+#include <memory>
+#include <stdint.h>
 
 namespace kytea  {
 
@@ -116,6 +121,44 @@ public:
 
 };
 
+// The Aho-Corasick automaton of a dictionary, stored as a double array
+// (Aoe "An Efficient Digital Search Algorithm by Using a Double-Array
+// Structure") so that the goto function is a single lookup. The transition
+// from state s with character c goes to t = bases[s]+c if checks[t] == s.
+// The failures, outputs and branches are flat arrays indexed by the same
+// positions, so the whole automaton can be used in place when it is read
+// from a memory-mapped model. The outputs of state s are found at
+// [outputStarts[s], outputStarts[s+1]). The root is always at position 0.
+class DictionaryAutomaton {
+public:
+    DictionaryAutomaton() : numStates(0) { }
+
+    // The check value of positions that are not used by any state
+    const static uint32_t EMPTY = 0xFFFFFFFF;
+
+    FlatArray<uint32_t> bases;
+    FlatArray<uint32_t> checks;
+    FlatArray<uint32_t> failures;
+    FlatArray<uint32_t> outputStarts;
+    FlatArray<uint32_t> outputs;
+    FlatArray<unsigned char> branches;
+    uint32_t numStates;
+
+    unsigned getNumStates() const { return numStates; }
+
+    inline unsigned step(unsigned state, KyteaChar input) const {
+        unsigned next = bases[state] + input;
+        return (next < checks.size() && checks[next] == state) ? next : 0;
+    }
+
+    // Convert from and to the states used when building the automaton. The
+    // states are numbered in breadth-first order when they are converted back
+    void build(const std::vector<DictionaryState*> & states);
+    void getStates(std::vector<DictionaryState> & states) const;
+
+    void clear();
+
+};
 
 // a dictionary that uses a FA tree and the Aho-Corasick algorithm for search
 //  Aho-Corasick "Efficient String Matching: An Aid to Bibliographic Search"
@@ -130,12 +173,21 @@ public:
     // A result of dictionary matching, containing pairs of the ending point
     // and the entry
     typedef std::vector< std::pair<unsigned,Entry*> > MatchResult;
+    // The same, but containing the id of the entry
+    typedef std::vector< std::pair<unsigned,unsigned> > MatchIdResult;
 
 private:
 
     StringUtil * util_;
-    std::vector<DictionaryState*> states_;
+    DictionaryAutomaton automaton_;
     std::vector<Entry*> entries_;
+    // Dictionaries of feature vectors that are read from a memory-mapped
+    // model keep all their values in one array, with valueSize_ values for
+    // each entry, instead of in entries_
+    FlatArray<FeatVal> values_;
+    unsigned valueSize_;
+    // The mapped file that the automaton and values point into, if any
+    std::shared_ptr<const MappedFile> mapping_;
     unsigned char numDicts_;
 
     // std::string space(unsigned lev) {
@@ -146,12 +198,12 @@ private:
     // }
 
     // Build the goto and failures for the Aho-Corasick method
-    void buildGoto(wm_const_iterator start, wm_const_iterator end, unsigned lev, unsigned nid);
-    void buildFailures();
+    void buildGoto(std::vector<DictionaryState*> & states, wm_const_iterator start, wm_const_iterator end, unsigned lev, unsigned nid);
+    void buildFailures(std::vector<DictionaryState*> & states);
 
 public:
 
-    Dictionary(StringUtil * util) : util_(util), numDicts_(0) { };
+    Dictionary(StringUtil * util) : util_(util), valueSize_(0), numDicts_(0) { };
 
     void clearData();
 
@@ -162,16 +214,63 @@ public:
     void buildIndex(const WordMap & input);
     void print();
 
-    const Entry * findEntry(KyteaString str) const;
-    Entry * findEntry(KyteaString str);
-    unsigned getTagID(KyteaString str, KyteaString tag, int lev);
+    // The lookups take views, so part of a string can be looked up without
+    // copying it (a KyteaString is converted to a view of all its characters)
+    const Entry * findEntry(const KyteaStringView & str) const;
+    Entry * findEntry(const KyteaStringView & str);
+    // Find the id of an entry, or -1 if it does not exist
+    int findEntryId(const KyteaStringView & str) const;
+    unsigned getTagID(const KyteaStringView & str, const KyteaString & tag, int lev);
+
+    MatchResult match( const KyteaStringView & chars ) const;
+    MatchIdResult matchIds( const KyteaStringView & chars ) const;
+    // Match into a buffer provided by the caller, which is cleared first, so
+    // a buffer that is reused does not need to allocate memory again
+    void match( const KyteaStringView & chars, MatchResult & ret ) const;
+    void matchIds( const KyteaStringView & chars, MatchIdResult & ret ) const;
+
+    // Call visitor(end, id) for every entry that matches chars, in order of
+    // the ending point, without allocating any memory. The string can be of
+    // any type that provides length() and operator[]
+    template <class String, class Visitor>
+    void visitMatches( const String & chars, Visitor visitor ) const {
+        if(getNumStates() == 0) return;
+        const unsigned len = chars.length();
+        const uint32_t * outputs = automaton_.outputs.data();
+        const uint32_t * outputStarts = automaton_.outputStarts.data();
+        unsigned currState = 0, nextState;
+        for(unsigned i = 0; i < len; i++) {
+            KyteaChar c = chars[i];
+            while((nextState = automaton_.step(currState, c)) == 0 && currState != 0)
+                currState = automaton_.failures[currState];
+            currState = nextState;
+            for(unsigned j = outputStarts[currState]; j < outputStarts[currState+1]; j++) 
+                visitor(i, outputs[j]);
+        }
+    }
+
+    inline Entry * getEntry(unsigned id) const {
+        if(id >= entries_.size())
+            THROW_ERROR("The entries of a memory-mapped dictionary must be accessed by id");
+        return entries_[id];
+    }
 
-    MatchResult match( const KyteaString & chars ) const;
+    // Get the values of entry id in a dictionary of feature vectors, and
+    // the number of values
+    const FeatVal * getValues(unsigned id) const;
+    unsigned getNumValues(unsigned id) const;
 
     std::vector<Entry*> & getEntries() { return entries_; }
-    std::vector<DictionaryState*> & getStates() { return states_; }
     const std::vector<Entry*> & getEntries() const { return entries_; }
-    const std::vector<DictionaryState*> & getStates() const { return states_; }
+    unsigned getNumEntries() const { return (valueSize_ ? values_.size()/valueSize_ : entries_.size()); }
+    DictionaryAutomaton & getAutomaton() { return automaton_; }
+    const DictionaryAutomaton & getAutomaton() const { return automaton_; }
+    unsigned getNumStates() const { return automaton_.getNumStates(); }
+    FlatArray<FeatVal> & getFlatValues() { return values_; }
+    const FlatArray<FeatVal> & getFlatValues() const { return values_; }
+    unsigned getValueSize() const { return valueSize_; }
+    void setValueSize(unsigned valueSize) { valueSize_ = valueSize; }
+    void setMapping(const std::shared_ptr<const MappedFile> & mapping) { mapping_ = mapping; }
     unsigned char getNumDicts() const { return numDicts_; }
     void setNumDicts(unsigned char numDicts) { numDicts_ = numDicts; }
 
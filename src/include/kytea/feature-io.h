@@ -11,11 +11,23 @@
 
 namespace kytea {
 
+// The first line of a binary feature file, which is followed by the
+//  encoding of the strings in the file
+#define FEATURE_IO_BINARY_HEADER "KyTea-features 1 B"
+
+// Reads and writes the features used in training (-feat/-featout). The
+//  text format has one line per example. The binary format stores the
+//  strings of each classifier (its tags and feature names) as a table of
+//  offsets and one block of characters, and its examples as arrays of
+//  labels, example lengths and feature ids (in CSR order), so it is loaded
+//  with a few bulk reads (or from a memory-mapped file) instead of being
+//  parsed line by line. The format of a file is detected when it is loaded.
 class FeatureIO {
 
 protected:
 
     std::ofstream * out_;
+    bool binary_;
 
     TagHash feats_;
     typedef std::map<KyteaString, ModelTagEntry*> WordMap;
@@ -25,7 +37,7 @@ protected:
 
 public:
     
-    FeatureIO() : out_(0), numTags_(0), numDicts_(0) { }
+    FeatureIO() : out_(0), binary_(false), numTags_(0), numDicts_(0) { }
     ~FeatureIO();
 
     int getNumTags() { return numTags_; }
@@ -34,7 +46,7 @@ public:
 
     void load(const std::string& fileName,StringUtil* util);
 
-    void openOut(const std::string& fileName);
+    void openOut(const std::string& fileName, bool binary = false);
     void closeOut();
     
     WordMap & getWordMap() { return wm_; }
@@ -48,6 +60,11 @@ public:
 
     void printWordMap(StringUtil * util);
 
+protected:
+
+    void loadText(std::istream & in, StringUtil * util);
+    void loadBinary(const std::string & fileName, StringUtil * util);
+
 };
 
 }
@@ -0,0 +1,57 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef KYTEA_FEATURE_KERNELS_H_
+#define KYTEA_FEATURE_KERNELS_H_
+
+#include <vector>
+#include <kytea/feature-vector.h>
+
+namespace kytea  {
+
+// The loop that adds feature values to scores. On x86 processors with
+// SSE4.1 or AVX2 this is vectorized, and the best version for the
+// processor is chosen when the library is loaded. Otherwise (and for
+// arrays that are too short to benefit) it is a plain loop.
+struct FeatKernels {
+    const char * name;
+    // sums[i] += vals[i] for i < n
+    void (*add)(FeatSum * sums, const FeatVal * vals, int n);
+};
+
+// The kernels in use
+extern FeatKernels featKernels;
+
+// Choose the kernels by name ("avx2", "sse4.1" or "scalar"). This returns
+// false if they are not supported on this processor. It must not be called
+// while sentences are being analyzed.
+bool setFeatKernels(const char * name);
+
+// Below this length the plain loops are faster than calling a kernel
+const static int FEAT_KERNEL_MIN = 8;
+
+inline void addFeatVals(FeatSum * sums, const FeatVal * vals, int n) {
+    if(n < FEAT_KERNEL_MIN) {
+        for(int i = 0; i < n; i++)
+            sums[i] += vals[i];
+    } else {
+        featKernels.add(sums, vals, n);
+    }
+}
+
+}
+
+#endif
@@ -15,6 +15,12 @@ class FeatureLookup {
 protected:
     Dictionary<FeatVec> *charDict_, *typeDict_, *selfDict_;
     FeatVec *dictVector_, *biases_, *tagDictVector_, *tagUnkVector_;
+
+    // Add the scores of the active dictionary features, which are numbered
+    // by boundary, dictionary, length and type. This sorts them and removes
+    // duplicates.
+    void addActiveDictionaryScores(std::vector<unsigned> & feats, int numDicts, int max, std::vector<FeatSum> & score);
+
 public:
     FeatureLookup() : charDict_(NULL), typeDict_(NULL), selfDict_(NULL), dictVector_(NULL), biases_(NULL), tagDictVector_(NULL), tagUnkVector_(NULL) { }
     ~FeatureLookup();
@@ -43,13 +49,16 @@ public:
     void addDictionaryScores(
         const Dictionary<ModelTagEntry>::MatchResult & matches,
         int numDicts, int max, std::vector<FeatSum> & score);
+    void addDictionaryScores(
+        const Dictionary<ModelTagEntry> * dict, const KyteaString & chars,
+        int numDicts, int max, std::vector<FeatSum> & score);
 
     void addTagNgrams(const KyteaString & chars, 
                       const Dictionary<FeatVec> * dict, 
                       std::vector<FeatSum> & scores,
                       int window, int startChar, int endChar);
 
-    void addSelfWeights(const KyteaString & chars, 
+    void addSelfWeights(const KyteaStringView & chars, 
                         std::vector<FeatSum> & scores,
                         int isType);
 
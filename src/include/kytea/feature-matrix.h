@@ -0,0 +1,111 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef KYTEA_FEATURE_MATRIX_H_
+#define KYTEA_FEATURE_MATRIX_H_
+
+#include <vector>
+#include <cstddef>
+
+namespace kytea  {
+
+// A feature of a training example, which is laid out in the same way as
+// liblinear's feature_node so that the examples can be trained on in place
+struct FeatureNode {
+    int index;
+    float value;
+};
+
+// The features of a set of training examples, stored one after another in a
+// single array. Each example is followed by a node for the bias feature
+// (which is filled in by setBias() before training) and a node with index -1
+// that ends the example, as liblinear expects.
+class FeatureMatrix {
+
+private:
+    std::vector<FeatureNode> nodes_;
+    // the start of each example in nodes_, followed by the end of the last
+    std::vector<size_t> starts_;
+
+public:
+
+    FeatureMatrix() : starts_(1, 0) { }
+
+    // The number of examples
+    size_t size() const { return starts_.size()-1; }
+    // The number of features of example i, not counting the bias
+    unsigned rowSize(size_t i) const { return starts_[i+1]-starts_[i]-2; }
+    // The features of example i
+    const FeatureNode * row(size_t i) const { return &nodes_[starts_[i]]; }
+    FeatureNode * row(size_t i) { return &nodes_[starts_[i]]; }
+    // The number of features of all examples, not counting the biases
+    size_t getNumFeatures() const { return nodes_.size()-2*size(); }
+
+    // Add a feature to the example that is being built, and finish it
+    void addFeature(unsigned id) {
+        FeatureNode node = { (int)id, 1 };
+        nodes_.push_back(node);
+    }
+    void endRow() {
+        FeatureNode end = { -1, 0 };
+        nodes_.push_back(end);
+        nodes_.push_back(end);
+        starts_.push_back(nodes_.size());
+    }
+    // Add an example with the features feats
+    void push_back(const std::vector<unsigned> & feats) {
+        for(unsigned i = 0; i < feats.size(); i++)
+            addFeature(feats[i]);
+        endRow();
+    }
+    // Add all of the examples of mat
+    void append(const FeatureMatrix & mat) {
+        const size_t offset = nodes_.size();
+        nodes_.insert(nodes_.end(), mat.nodes_.begin(), mat.nodes_.end());
+        for(size_t i = 1; i < mat.starts_.size(); i++)
+            starts_.push_back(mat.starts_[i]+offset);
+    }
+
+    // Set the bias feature of every example, or remove it if value < 0.
+    //  Nothing is written if the biases are already set, so several models
+    //  can be trained on the same examples at once.
+    void setBias(int id, double value) {
+        FeatureNode node = { (value >= 0 ? id : -1), (value >= 0 ? (float)value : 0) };
+        for(size_t i = 0; i < size(); i++) {
+            FeatureNode & bias = nodes_[starts_[i+1]-2];
+            if(bias.index != node.index || bias.value != node.value)
+                bias = node;
+        }
+    }
+
+    void reserve(size_t rows, size_t features) {
+        starts_.reserve(rows+1);
+        nodes_.reserve(features+2*rows);
+    }
+    void swap(FeatureMatrix & rhs) {
+        nodes_.swap(rhs.nodes_);
+        starts_.swap(rhs.starts_);
+    }
+    void clear() {
+        std::vector<FeatureNode>().swap(nodes_);
+        std::vector<size_t>(1, 0).swap(starts_);
+    }
+
+};
+
+}
+
+#endif
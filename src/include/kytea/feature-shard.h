@@ -0,0 +1,67 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef KYTEA_FEATURE_SHARD_H_
+#define KYTEA_FEATURE_SHARD_H_
+
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <kytea/kytea-model.h>
+
+namespace kytea  {
+
+// Collects the training examples of a set of classifiers while the corpus
+// is read. The examples are written to a binary file as they are found, and
+// only added to the feature matrices of the classifiers by load(), when the
+// size of each matrix is known and it can be allocated once. The file is
+// removed when the shard is deleted. If the file name is empty, the examples
+// are added to the feature matrices directly.
+class FeatureShard {
+
+private:
+    std::string fileName_;
+    std::ofstream * out_;
+    // the classifiers that have examples in the file, their ids in the file,
+    //  and the number of examples and features of each
+    std::vector<TagTriplet*> trips_;
+    std::unordered_map<TagTriplet*, unsigned> ids_;
+    std::vector<size_t> rows_, feats_;
+    // the example that is being written
+    std::vector<unsigned> buff_;
+
+    unsigned getId(TagTriplet * trip);
+    void write(unsigned id, int label);
+
+public:
+
+    FeatureShard(const std::string & fileName);
+    ~FeatureShard();
+
+    // Add an example with features feats and label to trip
+    void add(TagTriplet * trip, const std::vector<unsigned> & feats, int label);
+    // Add the examples xs with the labels ys to trip
+    void add(TagTriplet * trip, const FeatureMatrix & xs, const std::vector<int> & ys);
+
+    // Read the examples from the file and add them to their classifiers
+    void load();
+
+};
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 // #include <kytea/config.h>
 #include <iostream>
 #include <cstddef>
+#include <vector>
 // #include <fstream>
 // #include <sstream>
 // #include <stdint.h>
@@ -38,6 +39,66 @@ namespace kytea {
 class StringUtil;
 class KyteaString;
 
+// A stream buffer that reads a file descriptor (such as 0 for the standard
+// input) with one read() call per block. std::cin reads byte by byte while
+// it is synchronized with stdio, so the standard input is read through this
+// instead. Data that was already read through std::cin or stdin is not seen.
+class FileDescriptorBuf : public std::streambuf {
+
+public:
+
+    FileDescriptorBuf(int fd) : fd_(fd), buff_(BLOCK_SIZE) { }
+
+    // Whether the descriptor is a regular file, rather than a terminal or a
+    // pipe that might be waiting for the output of each line
+    bool isRegularFile() const;
+
+protected:
+
+    int_type underflow() override;
+
+private:
+
+    const static size_t BLOCK_SIZE = 1 << 16;
+
+    int fd_;
+    std::vector<char> buff_;
+
+};
+
+// Reads the lines of a stream in large blocks, and returns them as pointers
+// into the block, which are valid until the next call. Input that is already
+// available is taken in one read, but reading never waits for more input
+// than getline() would, so interactive input works as before. Once a reader
+// is used, the stream should not be read directly.
+class LineReader {
+
+public:
+
+    LineReader(std::istream & str) : str_(&str), start_(0), end_(0), eof_(false) { }
+
+    // Get the next line without its newline. Like getline(), this returns
+    // false (and sets eof() on the stream) if the stream ends before a
+    // newline, in which case line holds the rest of the input.
+    bool readLine(const char *& line, size_t & len);
+
+    std::istream * getStream() const { return str_; }
+
+private:
+
+    const static size_t BLOCK_SIZE = 1 << 20;
+
+    std::istream * str_;
+    std::vector<char> buff_;
+    size_t start_, end_;
+    bool eof_;
+
+    // Read more input after the unread data, which is moved to the start of
+    // the buffer. Return false at the end of the stream.
+    bool fill();
+
+};
+
 class GeneralIO {
 
 protected:
@@ -57,6 +57,12 @@ private:
 
     std::string featIn_, featOut_;
     std::ostream* featStr_;
+    bool featBin_;              // write the features in the binary format
+
+    // when not empty, the corpora are read from disk in each pass of
+    //  training instead of being held in memory, and the training examples
+    //  are written to temporary files in this directory
+    std::string streamDir_;
 
     bool doWS_, doTags_, doUnk_;
     std::vector<bool> doTag_;
@@ -88,6 +94,12 @@ private:
     double cost_;    // the cost for the SVM or LR training
     int solverType_; // the type of solver to be used
 
+    // the costs and solvers to try in a hyperparameter sweep, and the corpus
+    //  that the trained models are evaluated on to choose between them
+    std::vector<double> sweepCosts_;
+    std::vector<int> sweepSolvers_;
+    std::string heldOut_;
+
     // extra arguments, should be input/output for the analyzer
     std::vector<std::string> args_;
 
@@ -106,6 +118,12 @@ private:
     //  tagMax: the maximum number of tags to return for a word
     unsigned tagMax_;
 
+    // the number of threads to use for analysis and training (default: 1)
+    unsigned numThreads_;
+
+    // the number of unknown words whose tags are cached (default: 0, no cache)
+    unsigned unkCacheSize_;
+
     // check argument legality
     void ch(const char * n, const char* v);
 
@@ -148,6 +166,9 @@ public:
     const std::string & getFeatureIn() const { return featIn_; }
     const std::string & getFeatureOut() const { return featOut_; }
     const bool getWriteFeatures() const { return featOut_.length() > 0; }
+    const bool getFeatureBinary() const { return featBin_; }
+    const std::string & getStreamDir() const { return streamDir_; }
+    const bool getStreaming() const { return streamDir_.length() > 0; }
     
     const char getCharN() const { return charN_; }
     const char getCharWindow() const { return charW_; }
@@ -157,6 +178,8 @@ public:
     const char getUnkN() const { return unkN_; }
     const unsigned getTagMax() const { return tagMax_; }
     const unsigned getUnkBeam() const { return unkBeam_; }
+    const unsigned getNumThreads() const { return numThreads_; }
+    const unsigned getUnkCacheSize() const { return unkCacheSize_; }
     const std::string & getUnkTag() const { return unkTag_; }
     const std::string & getDefaultTag() const { return defTag_; }
     const std::string & getWsConstraint() const { return wsConstraint_; }
@@ -165,6 +188,10 @@ public:
     const double getEpsilon() const { return eps_; }
     const double getCost() const { return cost_; }
     const int getSolverType() const { return solverType_; }
+    const std::vector<double> & getSweepCosts() const { return sweepCosts_; }
+    const std::vector<int> & getSweepSolvers() const { return sweepSolvers_; }
+    const bool getSweeping() const { return sweepCosts_.size() > 0 || sweepSolvers_.size() > 0; }
+    const std::string & getHeldOut() const { return heldOut_; }
     const bool getDoWS() const { return doWS_; }
     const bool getDoUnk() const { return doUnk_; }
     const bool getDoTags() const { return doTags_; }
@@ -194,6 +221,9 @@ public:
     void setCost(double v) { cost_ = v; }
     void setBias(bool v) { bias_ = (v?1.0f:-1.0f); }
     void setSolverType(int v) { solverType_ = v; }
+    void addSweepCost(double v) { sweepCosts_.push_back(v); }
+    void addSweepSolver(int v) { sweepSolvers_.push_back(v); }
+    void setHeldOut(const std::string & v) { heldOut_ = v; }
     void setCharWindow(char v) { charW_ = v; }
     void setCharN(char v) { charN_ = v; }
     void setTypeWindow(char v) { typeW_ = v; }
@@ -202,6 +232,8 @@ public:
     void setUnkN(char v) { unkN_ = v; }
     void setTagMax(unsigned v) { tagMax_ = v; }
     void setUnkBeam(unsigned v) { unkBeam_ = v; }
+    void setNumThreads(unsigned v) { numThreads_ = v; }
+    void setUnkCacheSize(unsigned v) { unkCacheSize_ = v; }
     void setUnkTag(const std::string & v) { unkTag_ = v; }
     void setUnkTag(const char* v) { unkTag_ = v; }
     void setDefaultTag(const std::string & v) { defTag_ = v; }
@@ -227,6 +259,8 @@ public:
     void setGlobal(int v) { if((int)global_.size() <= v) global_.resize(v+1,false); global_[v] = true; } 
     void setFeatureIn(const std::string & featIn) { featIn_ = featIn; }
     void setFeatureOut(const std::string & featOut) { featOut_ = featOut; }
+    void setFeatureBinary(bool v) { featBin_ = v; }
+    void setStreamDir(const std::string & streamDir) { streamDir_ = streamDir; }
     void setWsConstraint(const std::string & wsConstraint) { wsConstraint_ = wsConstraint; }
 
     std::ostream * getFeatureOutStream();
@@ -18,14 +18,67 @@
 #define KYTEA_LM_H__
 
 #include <kytea/kytea-struct.h>
+#include <stdint.h>
 // #include <vector>
 
 namespace kytea {
 
+// The state of a language model while scoring a string one character at
+//  a time, which holds the previous n-1 characters
+typedef uint64_t KyteaLMState;
+
+// The n-grams of one length, where the characters of each n-gram are packed
+//  into a 64-bit key (16 bits each, the first character in the highest bits).
+//  They are stored in an open addressing hash table with float values.
+class PackedNgramTable {
+
+public:
+
+    PackedNgramTable() : mask_(0), hasEmptyKey_(false), emptyKeyVal_(0) { }
+
+    // add all n-grams of length len from the map
+    void build(const KyteaDoubleMap & map, unsigned len);
+
+    bool find(uint64_t key, double & val) const {
+        if(key == EMPTY_KEY) {
+            val = emptyKeyVal_;
+            return hasEmptyKey_;
+        }
+        if(keys_.empty())
+            return false;
+        for(uint64_t i = hash(key) & mask_; ; i = (i+1) & mask_) {
+            if(keys_[i] == key) {
+                val = vals_[i];
+                return true;
+            } else if(keys_[i] == EMPTY_KEY)
+                return false;
+        }
+    }
+
+private:
+
+    const static uint64_t EMPTY_KEY = ~(uint64_t)0;
+
+    static uint64_t hash(uint64_t key) {
+        return (key * 0x9E3779B97F4A7C15ULL) >> 32;
+    }
+
+    std::vector<uint64_t> keys_;
+    std::vector<float> vals_;
+    uint64_t mask_;
+    // an n-gram whose key is the same as the empty marker
+    bool hasEmptyKey_;
+    float emptyKeyVal_;
+
+};
+
 class KyteaLM {
 
 public:
 
+    // Models with n-grams of up to this length are scored with packed keys
+    const static unsigned MAX_PACKED_N = 4;
+
     unsigned n_, vocabSize_;
     KyteaDoubleMap probs_;
     KyteaDoubleMap fallbacks_;
@@ -36,17 +89,35 @@ public:
     // train a trigram model using Kneser-Ney smoothing
     void train(const std::vector<KyteaString> & corpus);
 
+    // build the packed tables from probs_ and fallbacks_, which must be
+    //  called after they are changed
+    void buildPackedTables();
+    bool isPacked() const { return !packedProbs_.empty(); }
+
     // score a string with the language model
     double score(const KyteaString & str) const;
 
     // score a single position in the string
-    double scoreSingle(const KyteaString & val, int pos);
+    double scoreSingle(const KyteaString & val, int pos) const;
+
+    // score a string one character at a time, starting with getStartState()
+    //  and ending with a character of 0. This can only be used if isPacked()
+    KyteaLMState getStartState() const { return 0; }
+    double scoreNext(KyteaLMState & state, KyteaChar next) const;
 
     const KyteaDoubleMap & getProbs() const { return probs_; }
     const KyteaDoubleMap & getFallbacks() const { return fallbacks_; }
 
     void checkEqual(const KyteaLM & rhs) const;
 
+private:
+
+    // the tables for each n-gram length (fallbacks_ start at length 0)
+    std::vector<PackedNgramTable> packedProbs_, packedFallbacks_;
+
+    // score the n-gram of the last n_ characters in key
+    double scorePacked(uint64_t key) const;
+
 };
 
 }
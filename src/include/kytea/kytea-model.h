@@ -21,6 +21,7 @@
 #include <kytea/feature-vector.h>
 #include <kytea/kytea-string.h>
 #include <kytea/kytea-struct.h>
+#include <kytea/feature-matrix.h>
 
 #define SIG_CUTOFF 1E-6
 
@@ -55,7 +56,7 @@ protected:
     FeatureLookup * featLookup_;
 
 public:
-    KyteaModel() : multiplier_(1.0f), bias_(1.0f), solver_(1), addFeat_(true), featLookup_(NULL) {
+    KyteaModel() : multiplier_(1.0f), bias_(1.0f), solver_(1), numW_(0), addFeat_(true), featLookup_(NULL) {
         KyteaString str;
         mapFeat(str);
     }
@@ -90,7 +91,7 @@ public:
     int getBiasId() { return (bias_?(int)names_.size():-1); }
 
     void setAddFeatures(bool addFeat) { addFeat_ = addFeat; }
-    bool getAddFeatures() { return addFeat_; }
+    bool getAddFeatures() const { return addFeat_; }
 
     const FeatNameVec & getNames() const { return names_; }
     const FeatNameVec & getOldNames() const { return oldNames_; }
@@ -99,9 +100,27 @@ public:
     // std::pair<int,double> runClassifier(const std::vector<unsigned> & feat);
     void printClassifier(const std::vector<unsigned> & feat, StringUtil * util, std::ostream & out = std::cerr);
 
-    void trainModel(const std::vector< std::vector<unsigned> > & xs, std::vector<int> & ys, double bias, int solver, double epsilon, double cost);
+    // Train the model, using up to numThreads threads in the solver. The
+    //  bias features of xs are set to bias before it is given to the solver
+    void trainModel(FeatureMatrix & xs, std::vector<int> & ys, double bias, int solver, double epsilon, double cost, int numThreads = 1);
     void trimModel();
 
+    // Exchange the contents of this model with rhs, including the ownership
+    //  of their feature lookups
+    void swap(KyteaModel & rhs) {
+        ids_.swap(rhs.ids_);
+        names_.swap(rhs.names_);
+        oldNames_.swap(rhs.oldNames_);
+        labels_.swap(rhs.labels_);
+        weights_.swap(rhs.weights_);
+        std::swap(multiplier_, rhs.multiplier_);
+        std::swap(bias_, rhs.bias_);
+        std::swap(solver_, rhs.solver_);
+        std::swap(numW_, rhs.numW_);
+        std::swap(addFeat_, rhs.addFeat_);
+        std::swap(featLookup_, rhs.featLookup_);
+    }
+
     inline const KyteaUnsignedMap & getIds() const { return ids_; }
     inline const unsigned getNumFeatures() const { return names_.size()-1; }
     inline const double getBias() const { return bias_; }
@@ -146,9 +165,59 @@ public:
 
 };
 
+// Maps the names of features to ids while features are extracted from
+// several parts of a corpus at once. Names that are already in the model are
+// given the model's ids. New names are given temporary ids (with LOCAL_BIT
+// set) in the order that they are first seen, and are added to the model by
+// addToModel(). If the maps of the parts are added in the order of the parts,
+// every feature gets the same id as it would if the whole corpus had been
+// mapped by the model itself. The model must not change until then.
+class LocalFeatureMap {
+
+public:
+    const static unsigned LOCAL_BIT = 1u << 31;
+
+    LocalFeatureMap(const KyteaModel * model) : model_(model) { }
+
+    unsigned mapFeat(const KyteaString & str) {
+        KyteaUnsignedMap::const_iterator it = model_->getIds().find(str);
+        if(it != model_->getIds().end())
+            return it->second;
+        if(!model_->getAddFeatures())
+            return 0;
+        it = ids_.find(str);
+        if(it != ids_.end())
+            return it->second;
+        unsigned ret = LOCAL_BIT | names_.size();
+        ids_[str] = ret;
+        names_.push_back(str);
+        return ret;
+    }
+
+    // Add the new names to model, and replace the temporary ids in feats
+    // with the ids of the model
+    void addToModel(KyteaModel * model, FeatureMatrix & feats) {
+        std::vector<unsigned> modelIds(names_.size());
+        for(unsigned i = 0; i < names_.size(); i++)
+            modelIds[i] = model->mapFeat(names_[i]);
+        for(size_t i = 0; i < feats.size(); i++) {
+            FeatureNode * myFeats = feats.row(i);
+            for(unsigned j = 0; j < feats.rowSize(i); j++)
+                if(myFeats[j].index & LOCAL_BIT)
+                    myFeats[j].index = modelIds[myFeats[j].index & ~LOCAL_BIT];
+        }
+    }
+
+private:
+    const KyteaModel * model_;
+    KyteaUnsignedMap ids_;
+    FeatNameVec names_;
+
+};
+
 class TagTriplet {
 public:
-    std::vector< std::vector<unsigned> > first;
+    FeatureMatrix first;
     std::vector<int> second;
     KyteaModel * third;
     std::vector<KyteaString> fourth;
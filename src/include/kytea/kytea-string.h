@@ -23,6 +23,8 @@
 #include <vector>
 #include <cstddef>
 #include <algorithm>
+#include <atomic>
+#include <new>
 // #include <stdexcept>
 // #include <cstring>
 // #include <sstream>
@@ -34,52 +36,100 @@ typedef unsigned short KyteaChar;
 
 class StringUtil;
 
-// an implementation of a string, kept in memory
+// The characters of a string that is too long to be stored in the
+// KyteaString itself. They are allocated together with this header, and
+// shared by copies of the string until one of them is changed.
 class KyteaStringImpl {
 
 public:
     unsigned length_;
-    unsigned count_;
-    KyteaChar* chars_;
+    // the reference count is atomic, so strings owned by a shared model
+    // can be copied from several analysis threads at once
+    std::atomic<unsigned> count_;
+    KyteaChar chars_[1];
 
-    KyteaStringImpl() : length_(0), count_(1), chars_(0) { }
-    KyteaStringImpl(unsigned length);
-    KyteaStringImpl(const KyteaStringImpl & impl);
-    ~KyteaStringImpl() {
-        if(chars_)
-            delete [] chars_;
-    }
+    // allocate an implementation with room for length characters
+    static KyteaStringImpl * create(unsigned length);
+    static KyteaStringImpl * create(const KyteaStringImpl & impl);
+    static void destroy(KyteaStringImpl * impl);
 
     unsigned dec() { return --count_; }
     unsigned inc() { return ++count_; }
 
+private:
+    KyteaStringImpl(unsigned length) : length_(length), count_(1) { }
+
 };
 
+// A string of KyteaChars. Strings of up to INLINE_LENGTH characters are
+// stored in the object itself, and longer strings share a reference counted
+// KyteaStringImpl with their copies. The characters are copied when a shared
+// string is changed.
+//
+// Like the standard containers, a single KyteaString may be read from several
+// threads at once, but must not be changed while another thread reads or
+// copies it. Different KyteaStrings can be used from different threads even
+// when they share their characters, as the reference count is atomic.
 class KyteaString {
 
 public:
     friend class StringUtil;
+
+    const static unsigned INLINE_LENGTH = 4;
     
 private:
-    KyteaStringImpl* impl_;
+    unsigned length_;
+    union {
+        KyteaChar inline_[INLINE_LENGTH];
+        KyteaStringImpl* impl_;
+    };
+
+    bool isInline() const { return length_ <= INLINE_LENGTH; }
+
+    void release() {
+        if(!isInline() && !impl_->dec())
+            KyteaStringImpl::destroy(impl_);
+    }
+
+    void copyFrom(const KyteaString & str) {
+        length_ = str.length_;
+        if(isInline()) {
+            std::copy(str.inline_, str.inline_+length_, inline_);
+        } else {
+            impl_ = str.impl_;
+            impl_->inc();
+        }
+    }
+
+    // take the characters of str, leaving it empty
+    void moveFrom(KyteaString & str) {
+        length_ = str.length_;
+        if(isInline())
+            std::copy(str.inline_, str.inline_+length_, inline_);
+        else
+            impl_ = str.impl_;
+        str.length_ = 0;
+    }
+
+    // the characters, which are copied first if they are shared
+    KyteaChar * getWritableChars();
 
 public:
 
     typedef std::vector<KyteaString> Tokens;
 
     // ctor
-    KyteaString() : impl_(0) { }
-    KyteaString(const KyteaString & str) { 
-        impl_ = str.impl_;
-        if(impl_) impl_->inc();
+    KyteaString() : length_(0) { }
+    KyteaString(const KyteaString & str) { copyFrom(str); }
+    KyteaString(KyteaString && str) { moveFrom(str); }
+    // a string of length characters, which are not initialized
+    KyteaString(unsigned length) : length_(length) {
+        if(!isInline())
+            impl_ = KyteaStringImpl::create(length);
     }
-    KyteaString(unsigned length) { impl_ = new KyteaStringImpl(length); }
     
     // dtor
-    ~KyteaString() {
-        if(impl_ && !impl_->dec())
-            delete impl_;
-    }
+    ~KyteaString() { release(); }
 
     // tokenize the string using the characters in the delimiter string
     Tokens tokenize(const KyteaString & delim, bool includeDelim = false) const;
@@ -88,10 +138,10 @@ public:
     void splice(const KyteaString& str, unsigned pos);
 
     bool contains(const KyteaChar c) const {
-        if(impl_)
-            for(unsigned i = 0; i < impl_->length_; i++)
-                if(impl_->chars_[i] == c)
-                    return true;
+        const KyteaChar * chars = getChars();
+        for(unsigned i = 0; i < length_; i++)
+            if(chars[i] == c)
+                return true;
         return false;
     }
 
@@ -101,41 +151,47 @@ public:
     
     inline KyteaChar & operator[](int i) {
 #ifdef KYTEA_SAFE
-        if(impl_ == 0 || i < 0 || (unsigned)i >= impl_->length_)
+        if(i < 0 || (unsigned)i >= length_)
             throw std::runtime_error("string index out of bounds");
 #endif
-        return getImpl()->chars_[i];
+        return (isInline() ? inline_ : getWritableChars())[i];
     }
     
     inline const KyteaChar & operator[](int i) const {
 #ifdef KYTEA_SAFE
-        if(impl_ == 0 || i < 0 || (unsigned)i >= impl_->length_)
+        if(i < 0 || (unsigned)i >= length_)
             throw std::runtime_error("string index out of bounds");
 #endif
-        return impl_->chars_[i];
+        return getChars()[i];
     }
     
     KyteaString & operator= (const KyteaString &str) {
-        if(impl_ && !impl_->dec())
-            delete impl_;
-        impl_ = str.impl_;
-        if(impl_) impl_->inc();
+        if(this != &str) {
+            release();
+            copyFrom(str);
+        }
+        return *this;
+    }
+    KyteaString & operator= (KyteaString &&str) {
+        if(this != &str) {
+            release();
+            moveFrom(str);
+        }
         return *this;
     }
 
 
     inline unsigned length() const {
-        return (impl_?impl_->length_:0); 
+        return length_; 
     }
 
     // Get the hash for this value
     size_t getHash() const;
 
-    // Get the implementation
-    inline const KyteaStringImpl * getImpl() const {
-        return impl_;
-    } 
-    KyteaStringImpl * getImpl();
+    // Get the characters
+    inline const KyteaChar * getChars() const {
+        return (isInline() ? inline_ : impl_->chars_);
+    }
 
     // Find if it begins with a particular string
     bool beginsWith(const KyteaString & s) const;
@@ -143,28 +199,20 @@ public:
 };
 
 inline KyteaString operator+(const KyteaString& a, const KyteaChar& b) {
-    const KyteaStringImpl * aimp = a.getImpl();
-    if(aimp == 0) {
-        KyteaString ret(1);
-        ret[0] = b;
-        return ret;
-    }
-    KyteaString ret(aimp->length_+1);
+    KyteaString ret(a.length()+1);
     ret.splice(a,0);
-    ret[aimp->length_]=b;
+    ret[a.length()]=b;
     return ret;
 }
 
 inline KyteaString operator+(const KyteaString& a, const KyteaString& b) {
-    const KyteaStringImpl * aimp = a.getImpl();
-    if(aimp == 0)
+    if(a.length() == 0)
         return b;
-    const KyteaStringImpl * bimp = b.getImpl();
-    if(bimp == 0)
+    if(b.length() == 0)
         return a;
-    KyteaString ret(aimp->length_+bimp->length_);
+    KyteaString ret(a.length()+b.length());
     ret.splice(a,0);
-    ret.splice(b,aimp->length_);
+    ret.splice(b,a.length());
     return ret;
 }
 
@@ -179,12 +227,14 @@ inline bool operator<(const KyteaString & a, const KyteaString & b) {
 }
 
 inline bool operator==(const KyteaString & a, const KyteaString & b) {
-    unsigned i;
     const unsigned al = a.length();
     if(al!=b.length())
         return false;
-    for(i = 0; i < al; i++)
-        if(a[i] != b[i]) return false;
+    const KyteaChar * ac = a.getChars(), * bc = b.getChars();
+    if(ac == bc)
+        return true;
+    for(unsigned i = 0; i < al; i++)
+        if(ac[i] != bc[i]) return false;
     return true;
 }
 
@@ -193,6 +243,73 @@ inline bool operator!=(const KyteaString & a, const KyteaString & b) {
 }
 
 
+// A range of characters in another string, which can be used to look up a
+// part of a string without copying it. A view does not own its characters, so
+// it must not be used after the string that it points into is changed or
+// destroyed.
+class KyteaStringView {
+
+private:
+    const KyteaChar * chars_;
+    unsigned length_;
+
+public:
+
+    KyteaStringView() : chars_(0), length_(0) { }
+    KyteaStringView(const KyteaChar * chars, unsigned length) : chars_(chars), length_(length) { }
+    // a view of the whole of str, or of l characters starting at s
+    KyteaStringView(const KyteaString & str) : chars_(str.getChars()), length_(str.length()) { }
+    KyteaStringView(const KyteaString & str, unsigned s, unsigned l) : chars_(str.getChars()+s), length_(l) {
+#ifdef KYTEA_SAFE
+        if(s+l > str.length())
+            throw std::runtime_error("string view out of bounds");
+#endif
+    }
+
+    inline const KyteaChar & operator[](int i) const {
+#ifdef KYTEA_SAFE
+        if(i < 0 || (unsigned)i >= length_)
+            throw std::runtime_error("string index out of bounds");
+#endif
+        return chars_[i];
+    }
+
+    inline unsigned length() const { return length_; }
+    inline const KyteaChar * getChars() const { return chars_; }
+
+    KyteaStringView substr(unsigned s, unsigned l) const {
+        return KyteaStringView(chars_+s, l);
+    }
+
+    // copy the characters into a new string
+    KyteaString str() const {
+        KyteaString ret(length_);
+        if(length_ > 0)
+            std::copy(chars_, chars_+length_, &ret[0]);
+        return ret;
+    }
+
+    // the same hash as a KyteaString with the same characters
+    size_t getHash() const {
+        size_t hash = 5381;
+        for(unsigned i = 0; i < length_; i++)
+            hash = ((hash << 5) + hash) + chars_[i]; /* hash * 33 + x[i] */
+        return hash;
+    }
+
+};
+
+inline bool operator==(const KyteaStringView & a, const KyteaStringView & b) {
+    if(a.length() != b.length())
+        return false;
+    const KyteaChar * ac = a.getChars(), * bc = b.getChars();
+    return ac == bc || std::equal(ac, ac+a.length(), bc);
+}
+
+inline bool operator!=(const KyteaStringView & a, const KyteaStringView & b) {
+    return !(a==b);
+}
+
 // hashing using the djb2 algorithm
 //  found at
 //  http://www.cse.yorku.ca/~oz/hash.html
@@ -201,6 +318,9 @@ public:
     size_t operator()(const KyteaString & x) const {
         return x.getHash();
     }
+    size_t operator()(const KyteaStringView & x) const {
+        return x.getHash();
+    }
 };
 
 }
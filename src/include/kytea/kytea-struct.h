@@ -36,6 +36,9 @@ class KyteaStringMap : public std::unordered_map<kytea::KyteaString,T,kytea::Kyt
 
 namespace kytea  {
 
+class ModelTagEntry;
+template <class Entry> class Dictionary;
+
 // Map equality checking function
 template <class T>
 void checkMapEqual(const KyteaStringMap<T> & a, const KyteaStringMap<T> & b);
@@ -53,7 +56,7 @@ inline bool operator<(const KyteaTag & a, const KyteaTag & b) {
 //  a single word, with multiple lists of candidates for each tag
 class KyteaWord {
 public:
-    KyteaWord(const KyteaString & s, const KyteaString & n) : surface(s), norm(n), isCertain(true), unknown(false) { }
+    KyteaWord(const KyteaString & s, const KyteaString & n) : surface(s), norm(n), isCertain(true), unknown(false), entryDict(0), entry(0) { }
 
     // The surface form of the word
     KyteaString surface;
@@ -65,6 +68,11 @@ public:
     bool isCertain;
     // Whether this is an unknown word
     bool unknown;
+    // The entry for norm in the dictionary entryDict (0 if it is not there),
+    // which is found once and used by word segmentation and all tag levels.
+    // entryDict is 0 until the word has been looked up.
+    const Dictionary<ModelTagEntry> * entryDict;
+    const ModelTagEntry * entry;
 
     // get a tag for a certain level
     void limitTags(unsigned lev, unsigned lim) {
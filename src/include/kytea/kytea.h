@@ -19,6 +19,9 @@
 
 #include <kytea/kytea-config.h>
 #include <kytea/kytea-struct.h>
+#include <kytea/lru-cache.h>
+#include <algorithm>
+#include <functional>
 #include <vector>
 
 namespace kytea  {
@@ -32,6 +35,57 @@ class ProbTagEntry;
 class KyteaModel;
 class KyteaLM;
 class FeatureIO;
+class FeatureMatrix;
+class TagTriplet;
+class CorpusIO;
+
+// The settings that the tags of an unknown word depend on, which are used
+//  as the key for the cache of unknown word tags
+class UnkTagKey {
+public:
+    KyteaString norm;
+    int lev;
+    unsigned beam, tagMax;
+
+    UnkTagKey(const KyteaString & n, int l, unsigned b, unsigned t) :
+        norm(n), lev(l), beam(b), tagMax(t) { }
+
+    bool operator==(const UnkTagKey & rhs) const {
+        return lev == rhs.lev && beam == rhs.beam && tagMax == rhs.tagMax && norm == rhs.norm;
+    }
+};
+class UnkTagKeyHash {
+public:
+    size_t operator()(const UnkTagKey & x) const {
+        return x.norm.getHash() ^ ((size_t)x.lev << 24) ^ ((size_t)x.beam << 8) ^ x.tagMax;
+    }
+};
+typedef LruCache<UnkTagKey, std::vector<KyteaTag>, UnkTagKeyHash> UnkTagCache;
+
+// One setting of a hyperparameter sweep, and how well the models trained
+//  with it did on the held-out corpus
+class SweepResult {
+public:
+    int solver;
+    double cost;
+    // The time spent training the classifiers, in seconds
+    double time;
+    // The word segmentation F-measure, and the accuracy of each tag (less
+    //  than zero if they were not tested)
+    double wsFMeas;
+    std::vector<double> tagAccs;
+
+    SweepResult(int s, double c) : solver(s), cost(c), time(0), wsFMeas(-1) { }
+
+    // The mean of the measures that were tested
+    double getScore() const {
+        double sum = std::max(wsFMeas, 0.0);
+        int count = (wsFMeas >= 0 ? 1 : 0);
+        for(unsigned i = 0; i < tagAccs.size(); i++)
+            if(tagAccs[i] >= 0) { sum += tagAccs[i]; count++; }
+        return count ? sum/count : 0;
+    }
+};
 
 // a class representing the main analyzer
 class Kytea {
@@ -46,6 +100,8 @@ private:
     KyteaConfig* config_;
     Dictionary<ModelTagEntry> * dict_;
     Sentences sentences_;
+    // The number of tags that the corpora are read with
+    int corpusTags_;
 
     // Values for the word segmentation models
     KyteaModel* wsModel_;
@@ -61,6 +117,17 @@ private:
 
     FeatureIO* fio_;
 
+    // The tags of recently estimated unknown words (null if disabled)
+    mutable UnkTagCache* unkCache_;
+
+    // The settings of each point of a hyperparameter sweep (empty if not
+    //  sweeping), and the classifiers that were trained for them. The
+    //  classifiers of the first point are trained in place (and are the
+    //  first of each vector), while those of the others are copies that
+    //  are swapped in to be tested.
+    std::vector<SweepResult> sweepResults_;
+    std::vector< std::vector<KyteaModel*> > sweepMods_;
+
 public:
 
 ///////////////////////////////////////////////////////////////////
@@ -76,19 +143,39 @@ public:
     //  by the parameters in KyteaConfig
     void writeModel(const char* fileName);
 
+    // The analysis functions below are const, and do not change the model
+    //  or the vocabulary of the StringUtil, so a single loaded instance
+    //  can be used to analyze sentences from multiple threads at once.
+    //  Sentences for these threads should be created with the const
+    //  StringUtil (mapString/normalize), which maps unseen characters
+    //  to reserved ids instead of adding them.
+
     // Calculate the word segmentation for a sentence
-    void calculateWS(KyteaSentence & sent);
+    void calculateWS(KyteaSentence & sent) const;
     
     // Calculate the tagss for a sentence
-    void calculateTags(KyteaSentence & sent, int lev);
+    void calculateTags(KyteaSentence & sent, int lev) const;
 
     // Calculate the unknown pronunciation for a single unknown word
-    void calculateUnknownTag(KyteaWord & str, int lev);
+    void calculateUnknownTag(KyteaWord & str, int lev) const;
+
+    // Remember the tags of up to "size" unknown words, so words that appear
+    //  repeatedly are only estimated once (0 disables the cache). This is
+    //  also set from config_->getUnkCacheSize() when a model is loaded.
+    void setUnkCacheSize(unsigned size);
+    // The number of unknown words found and not found in the cache
+    unsigned long getUnkCacheHits() const { return unkCache_ ? unkCache_->getHits() : 0; }
+    unsigned long getUnkCacheMisses() const { return unkCache_ ? unkCache_->getMisses() : 0; }
+
+    // Calculate the word segmentation (if enabled) and all enabled tags
+    //  for a sentence, as specified by the current KyteaConfig
+    void analyzeSentence(KyteaSentence & sent) const;
 
     // Get the string utility class that allows you to map to/from
     //  Kyteas internal string representation (using 
     //  mapString/showString)
     StringUtil* getStringUtil() { return config_->getStringUtil(); }
+    const StringUtil* getStringUtil() const { return config_->getStringUtil(); }
 
     // Get the the configuration of this isntance of KyTea
     KyteaConfig* getConfig() { return config_; }
@@ -97,6 +184,9 @@ public:
     //  the appropriate settings in KyteaConfig first
     //  "trainAll" performs full training of Kytea from start to finish
     void trainAll();
+    //  When training with -sweepcost or -sweepsolver, the result of each
+    //  setting, in the order they were trained
+    const std::vector<SweepResult> & getSweepResults() const { return sweepResults_; }
     //  "analyze" loads models, and analyzes the full corpus input
     void analyze();
 
@@ -133,16 +223,38 @@ private:
 
     // functions to create dictionaries
     void buildVocabulary();
+
+    // Call func for the training sentences. Normally it is called once with
+    //  all of sentences_, but when streaming, the corpora are read again and
+    //  it is called for each group of sentences, which are then deleted
+    void forTrainingSentences(const std::function<void(const Sentences &)> & func);
     
     // a function that checks to make sure that configuration is correct before
     //  training
     void trainSanityCheck();
 
+    // Train the classifiers of trips, with the largest first. When sweeping,
+    //  a classifier is trained for every point of the sweep.
+    void trainClassifiers(const std::vector<TagTriplet*> & trips);
+    // Exchange the classifiers of sweep point g with those of the first
+    void swapSweepModels(unsigned g);
+    // Test the classifiers of each point of the sweep on the held-out
+    //  corpus, and keep the most accurate
+    void chooseSweepModels();
+    // Analyze the held-out sentences and add the accuracy to result
+    void testSweepModels(const Sentences & sents, SweepResult & result);
+
     // functions for word segmentation
     void trainWS();
+    // Add the word segmentation examples of sents to xs and ys, counting the
+    //  sentences in count
+    void wsFeatures(const Sentences & sents, FeatureMatrix & xs, std::vector<int> & ys, unsigned & count);
     void preparePrefixes();
     unsigned wsDictionaryFeatures(const KyteaString & sent, SentenceFeatures & feat);
     unsigned wsNgramFeatures(const KyteaString & sent, SentenceFeatures & feat, const std::vector<KyteaString> & prefixes, int n);
+    // The same, but mapping the features with featMap instead of the model
+    template <class FeatMap>
+    unsigned wsNgramFeatures(const KyteaString & sent, SentenceFeatures & feat, const std::vector<KyteaString> & prefixes, int n, FeatMap & featMap);
 
     // functions for tagging
     void trainLocalTags(int lev);
@@ -154,7 +266,13 @@ private:
     // Get matches of the dictionary for a single word in the form of
     // { <x_1, y_1>, <x_2, y_2> }
     // where x is the dictionary and y is the tag that exists in the dicitonary
-    std::vector<std::pair<int,int> > getDictionaryMatches(const KyteaString & str, int lev);
+    std::vector<std::pair<int,int> > getDictionaryMatches(const KyteaStringView & str, int lev) const;
+    // The same for a dictionary entry that has already been found
+    std::vector<std::pair<int,int> > getDictionaryMatches(const ModelTagEntry * ent, int lev) const;
+
+    // Find the dictionary entry of a word, or reuse the entry that was found
+    //  before (see KyteaWord::entry)
+    const ModelTagEntry * findWordEntry(KyteaWord & word) const;
 
 
     template <class Entry>
@@ -169,8 +287,21 @@ private:
     void buildFeatureLookups();
 
     void analyzeInput();
+
+    // analyze the input with config_->getNumThreads() worker threads,
+    //  writing the sentences in the same order as they were read. in and
+    //  out must use inUtil and outUtil, which are copies of the model's
+    //  StringUtil
+    void analyzeParallel(CorpusIO & in, CorpusIO & out, const StringUtil & inUtil, StringUtil & outUtil);
     
-    std::vector<KyteaTag> generateTagCandidates(const KyteaString & str, int lev);
+    // map the strings used during analysis and build the lazily initialized
+    //  members of the StringUtil, so the const analysis functions never need
+    //  to add to the vocabulary
+    void prepareAnalysis();
+
+    // search for the most likely tags of an unknown word, and return up to
+    //  config_->getTagMax() of them with their probabilities
+    std::vector<KyteaTag> generateTagCandidates(const KyteaString & str, int lev) const;
 
 };
 
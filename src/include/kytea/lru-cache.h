@@ -0,0 +1,107 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef KYTEA_LRU_CACHE_H_
+#define KYTEA_LRU_CACHE_H_
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace kytea  {
+
+// A cache that holds at most a fixed number of values, and discards the
+// least recently used value when it is full. All functions lock the cache,
+// so it can be shared by threads that are analyzing different sentences.
+template <class Key, class Value, class Hash = std::hash<Key> >
+class LruCache {
+
+private:
+
+    typedef std::list< std::pair<Key,Value> > Entries;
+    typedef std::unordered_map<Key, typename Entries::iterator, Hash> Index;
+
+    // The entries, from the most to the least recently used
+    Entries entries_;
+    Index index_;
+    unsigned capacity_;
+    unsigned long hits_, misses_;
+    mutable std::mutex mutex_;
+
+public:
+
+    LruCache(unsigned capacity) : capacity_(capacity), hits_(0), misses_(0) { }
+
+    // Copy the value for key into val and return true if it is in the cache
+    bool find(const Key & key, Value & val) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        typename Index::iterator it = index_.find(key);
+        if(it == index_.end()) {
+            misses_++;
+            return false;
+        }
+        hits_++;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        val = it->second->second;
+        return true;
+    }
+
+    // Add a value to the cache, replacing any value for the same key
+    void add(const Key & key, const Value & val) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(capacity_ == 0)
+            return;
+        typename Index::iterator it = index_.find(key);
+        if(it != index_.end()) {
+            it->second->second = val;
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return;
+        }
+        if(index_.size() >= capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+        entries_.push_front(std::pair<Key,Value>(key, val));
+        index_[key] = entries_.begin();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        index_.clear();
+        hits_ = misses_ = 0;
+    }
+
+    unsigned getCapacity() const { return capacity_; }
+    unsigned size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return index_.size();
+    }
+    unsigned long getHits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hits_;
+    }
+    unsigned long getMisses() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return misses_;
+    }
+
+};
+
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef KYTEA_MAPPED_FILE_H_
+#define KYTEA_MAPPED_FILE_H_
+
+#include <vector>
+#include <cstddef>
+
+namespace kytea  {
+
+// A read-only view of the whole contents of a file. When mmap() is available
+// the file is mapped into memory, so pages are only loaded when they are used
+// and are shared between processes that load the same model. Otherwise the
+// contents are read into a buffer.
+class MappedFile {
+
+public:
+
+    MappedFile(const char* fileName);
+    ~MappedFile();
+
+    const char * getData() const { return data_; }
+    size_t getSize() const { return size_; }
+    bool isMapped() const { return mapped_; }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+private:
+
+    const char * data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<char> buffer_;
+
+};
+
+// An array that either owns its values, or points to values that are owned
+// by somebody else (such as a memory-mapped model file)
+template <class T>
+class FlatArray {
+
+public:
+
+    FlatArray() : data_(0), size_(0) { }
+
+    // Take the contents of vec (without making a copy)
+    void assign(std::vector<T> & vec) {
+        owned_.swap(vec);
+        data_ = (owned_.size() ? &owned_[0] : 0);
+        size_ = owned_.size();
+    }
+    // Point to an external array, which must outlive this one
+    void setView(const T * data, size_t size) {
+        std::vector<T>().swap(owned_);
+        data_ = data;
+        size_ = size;
+    }
+    void clear() { setView(0, 0); }
+
+    const T & operator[](size_t i) const { return data_[i]; }
+    const T * data() const { return data_; }
+    size_t size() const { return size_; }
+
+    FlatArray(const FlatArray &) = delete;
+    FlatArray & operator=(const FlatArray &) = delete;
+
+private:
+
+    std::vector<T> owned_;
+    const T * data_;
+    size_t size_;
+
+};
+
+}
+
+#endif
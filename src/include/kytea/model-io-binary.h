@@ -41,23 +41,26 @@ public:
             THROW_ERROR("Only 8 dictionaries may be stored in a binary file.");
         writeBinary(dict->getNumDicts());
         // write the states
-        const std::vector<DictionaryState*> & states = dict->getStates();
+        std::vector<DictionaryState> states;
+        dict->getAutomaton().getStates(states);
         writeBinary((uint32_t)states.size());
         for(unsigned i = 0; i < states.size(); i++) {
-            const DictionaryState * state = states[i];
-            writeBinary((uint32_t)state->failure);
-            writeBinary((uint32_t)state->gotos.size());
-            for(unsigned j = 0; j < state->gotos.size(); j++) {
-                writeBinary((KyteaChar)state->gotos[j].first);
-                writeBinary((uint32_t)state->gotos[j].second);
+            const DictionaryState & state = states[i];
+            writeBinary((uint32_t)state.failure);
+            writeBinary((uint32_t)state.gotos.size());
+            for(unsigned j = 0; j < state.gotos.size(); j++) {
+                writeBinary((KyteaChar)state.gotos[j].first);
+                writeBinary((uint32_t)state.gotos[j].second);
             }
-            writeBinary((uint32_t)state->output.size());
-            for(unsigned j = 0; j < state->output.size(); j++) 
-                writeBinary((uint32_t)state->output[j]);
-            writeBinary(state->isBranch);
+            writeBinary((uint32_t)state.output.size());
+            for(unsigned j = 0; j < state.output.size(); j++) 
+                writeBinary((uint32_t)state.output[j]);
+            writeBinary(state.isBranch);
         }
         // write the entries
         const std::vector<Entry*> & entries = dict->getEntries();
+        if(entries.size() != dict->getNumEntries())
+            THROW_ERROR("Models read from a memory-mapped file can only be written in the memory-mapped format");
         writeBinary((uint32_t)entries.size());
         for(unsigned i = 0; i < entries.size(); i++)
             writeEntry(entries[i]);
@@ -87,8 +90,7 @@ public:
         unsigned numDicts = readBinary<unsigned char>();
         dict->setNumDicts(numDicts);
         // get the states
-        std::vector<DictionaryState*> & states = dict->getStates();
-        states.resize(readBinary<uint32_t>());
+        std::vector<DictionaryState*> states(readBinary<uint32_t>());
         if(states.size() == 0) {
             delete dict;
             return 0;
@@ -107,6 +109,9 @@ public:
             state->isBranch = readBinary<bool>();
             states[i] = state;
         }
+        dict->getAutomaton().build(states);
+        for(unsigned i = 0; i < states.size(); i++)
+            delete states[i];
         // get the entries
         std::vector<Entry*> & entries = dict->getEntries();
         entries.resize(readBinary<uint32_t>());
@@ -115,6 +120,11 @@ public:
         return dict;
     }
 
+protected:
+
+    // Write the first line of the model, containing the version and format
+    virtual void writeHeader(const KyteaConfig & config);
+
 };
 
 }
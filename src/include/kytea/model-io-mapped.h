@@ -0,0 +1,160 @@
+#ifndef MODEL_IO_MAPPED_H__
+#define MODEL_IO_MAPPED_H__
+
+#include <kytea/model-io-binary.h>
+#include <kytea/mapped-file.h>
+#include <kytea/kytea-util.h>
+#include <streambuf>
+#include <memory>
+
+namespace kytea {
+
+// A read-only stream buffer over a region of memory, which also allows
+// arrays to be skipped over so that they can be used in place
+class MappedStreamBuf : public std::streambuf {
+
+public:
+
+    MappedStreamBuf(const char * data, size_t size) {
+        char * start = const_cast<char*>(data);
+        setg(start, start, start+size);
+    }
+
+    size_t getOffset() const { return gptr() - eback(); }
+    size_t getSize() const { return egptr() - eback(); }
+    const char * getData() const { return eback(); }
+    void setOffset(size_t offset) { setg(eback(), eback()+offset, egptr()); }
+
+};
+
+// The memory-mapped model format. This is the same as the binary format,
+// except that the Aho-Corasick automata of all dictionaries and the values of
+// all feature dictionaries are stored as aligned flat arrays, which are used
+// in place after the model file is mapped into memory. Only these arrays are
+// mapped: the tag entries (with their classifiers), the word lists and the
+// subword LMs are read into memory as in the binary format, so they are
+// neither loaded lazily nor shared between processes.
+class MappedModelIO : public BinaryModelIO {
+
+public:
+
+    // Arrays are aligned to this many bytes from the start of the file
+    const static size_t ALIGNMENT = 8;
+
+    MappedModelIO(StringUtil* util) : BinaryModelIO(util), buf_(0), stream_(0) { }
+    MappedModelIO(StringUtil* util, const char* file, bool out);
+    MappedModelIO(StringUtil* util, std::iostream & str, bool out);
+    ~MappedModelIO();
+
+    void writeModelDictionary(const Dictionary<ModelTagEntry> * dict) override { writeDictionary(dict); }
+    void writeProbDictionary(const Dictionary<ProbTagEntry> * dict) override { writeDictionary(dict); }
+    void writeVectorDictionary(const Dictionary<FeatVec > * dict) override;
+
+    Dictionary<ModelTagEntry> * readModelDictionary() override { return readDictionary<ModelTagEntry>(); }
+    Dictionary<ProbTagEntry> * readProbDictionary() override { return readDictionary<ProbTagEntry>(); }
+    Dictionary<FeatVec > * readVectorDictionary() override;
+
+protected:
+
+    void writeHeader(const KyteaConfig & config) override;
+
+private:
+
+    std::shared_ptr<const MappedFile> mapping_;
+    MappedStreamBuf * buf_;
+    std::iostream * stream_;
+
+    template <class T>
+    void writeArray(const T * data, size_t size) {
+        writeBinary((uint32_t)size);
+        while(str_->tellp() % ALIGNMENT != 0)
+            str_->put(0);
+        if(size > 0)
+            str_->write(reinterpret_cast<const char*>(data), sizeof(T)*size);
+    }
+    template <class T>
+    void writeArray(const FlatArray<T> & arr) {
+        writeArray(arr.data(), arr.size());
+    }
+
+    // Point arr at an array in the mapped file, and skip over it
+    template <class T>
+    void readArray(FlatArray<T> & arr) {
+        size_t size = readBinary<uint32_t>();
+        size_t offset = buf_->getOffset();
+        offset += (ALIGNMENT - offset % ALIGNMENT) % ALIGNMENT;
+        if(offset + sizeof(T)*size > buf_->getSize())
+            THROW_ERROR("Badly formed model (array extends past the end of the file)");
+        arr.setView(reinterpret_cast<const T*>(buf_->getData()+offset), size);
+        buf_->setOffset(offset + sizeof(T)*size);
+    }
+
+    // Write and read the numbers of dictionaries and the automaton, where a
+    // null dictionary is written as having no states
+    template <class Entry>
+    bool writeAutomaton(const Dictionary<Entry> * dict) {
+        if(dict == 0) {
+            writeBinary((unsigned char)0);
+            writeBinary((uint32_t)0);
+            return false;
+        }
+        if(dict->getNumDicts() > 8)
+            THROW_ERROR("Only 8 dictionaries may be stored in a binary file.");
+        writeBinary(dict->getNumDicts());
+        const DictionaryAutomaton & automaton = dict->getAutomaton();
+        writeBinary((uint32_t)automaton.getNumStates());
+        writeArray(automaton.bases);
+        writeArray(automaton.checks);
+        writeArray(automaton.failures);
+        writeArray(automaton.outputStarts);
+        writeArray(automaton.outputs);
+        writeArray(automaton.branches);
+        return true;
+    }
+    template <class Entry>
+    Dictionary<Entry> * readAutomaton() {
+        unsigned numDicts = readBinary<unsigned char>();
+        unsigned numStates = readBinary<uint32_t>();
+        if(numStates == 0)
+            return 0;
+        Dictionary<Entry> * dict = new Dictionary<Entry>(util_);
+        dict->setNumDicts(numDicts);
+        dict->setMapping(mapping_);
+        DictionaryAutomaton & automaton = dict->getAutomaton();
+        automaton.numStates = numStates;
+        readArray(automaton.bases);
+        readArray(automaton.checks);
+        readArray(automaton.failures);
+        readArray(automaton.outputStarts);
+        readArray(automaton.outputs);
+        readArray(automaton.branches);
+        return dict;
+    }
+
+    // Dictionaries with tag entries store the entries as in the binary format
+    template <class Entry>
+    void writeDictionary(const Dictionary<Entry> * dict) {
+        if(!writeAutomaton(dict))
+            return;
+        const std::vector<Entry*> & entries = dict->getEntries();
+        writeBinary((uint32_t)entries.size());
+        for(unsigned i = 0; i < entries.size(); i++)
+            writeEntry(entries[i]);
+    }
+    template <class Entry>
+    Dictionary<Entry> * readDictionary() {
+        Dictionary<Entry> * dict = readAutomaton<Entry>();
+        if(dict == 0)
+            return 0;
+        std::vector<Entry*> & entries = dict->getEntries();
+        entries.resize(readBinary<uint32_t>());
+        for(unsigned i = 0; i < entries.size(); i++)
+            entries[i] = readEntry<Entry>();
+        return dict;
+    }
+
+};
+
+}
+
+#endif
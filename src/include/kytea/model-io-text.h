@@ -39,24 +39,28 @@ public:
         }
         // write the states
         *str_ << (unsigned)dict->getNumDicts() << std::endl;
-        const std::vector<DictionaryState*> & states = dict->getStates();
+        std::vector<DictionaryState> states;
+        dict->getAutomaton().getStates(states);
         *str_ << states.size() << std::endl;
         if(states.size() == 0)
             return;
         for(unsigned i = 0; i < states.size(); i++) {
-            *str_ << states[i]->failure;
-            for(unsigned j = 0; j < states[i]->gotos.size(); j++)
-                *str_ << " " << util_->showChar(states[i]->gotos[j].first) << " " << states[i]->gotos[j].second;
+            const DictionaryState & state = states[i];
+            *str_ << state.failure;
+            for(unsigned j = 0; j < state.gotos.size(); j++)
+                *str_ << " " << util_->showChar(state.gotos[j].first) << " " << state.gotos[j].second;
             *str_ << std::endl;
-            for(unsigned j = 0; j < states[i]->output.size(); j++) {
+            for(unsigned j = 0; j < state.output.size(); j++) {
                 if(j!=0) *str_ << " ";
-                *str_ << states[i]->output[j];
+                *str_ << state.output[j];
             }
             *str_ << std::endl;
-            *str_ << (states[i]->isBranch?'b':'n') << std::endl;
+            *str_ << (state.isBranch?'b':'n') << std::endl;
         }
         // write the entries
         const std::vector<Entry*> & entries = dict->getEntries();
+        if(entries.size() != dict->getNumEntries())
+            THROW_ERROR("Models read from a memory-mapped file can only be written in the memory-mapped format");
         *str_ << entries.size() << std::endl;
         for(unsigned i = 0; i < entries.size(); i++)
             writeEntry((Entry*)entries[i]);
@@ -87,9 +91,8 @@ public:
         std::getline(*str_, line);
         dict->setNumDicts(util_->parseInt(line.c_str()));
         // get the states
-        std::vector<DictionaryState*> & states = dict->getStates();
         getline(*str_, line);
-        states.resize(util_->parseInt(line.c_str()));
+        std::vector<DictionaryState*> states(util_->parseInt(line.c_str()));
         if(states.size() == 0) {
             delete dict;
             return 0;
@@ -119,6 +122,9 @@ public:
             state->isBranch = (line[0] == 'b');
             states[i] = state;
         }
+        dict->getAutomaton().build(states);
+        for(unsigned i = 0; i < states.size(); i++)
+            delete states[i];
         // get the entries
         std::vector<Entry*> & entries = dict->getEntries();
         getline(*str_, line);
@@ -24,8 +24,10 @@
 
 #if DISABLE_QUANTIZE
 #   define MODEL_IO_VERSION "0.4.0NQ"
+#   define MODEL_IO_MAPPED_VERSION "0.5.1NQ"
 #else
 #   define MODEL_IO_VERSION "0.4.0"
+#   define MODEL_IO_MAPPED_VERSION "0.5.1"
 #endif
 
 namespace kytea {
@@ -43,6 +45,7 @@ public:
     typedef char Format;
     const static Format FORMAT_BINARY = 'B';
     const static Format FORMAT_TEXT = 'T';
+    const static Format FORMAT_MAPPED = 'M';
     const static Format FORMAT_UNKNOWN = 'U';
 
     int numTags_;
@@ -0,0 +1,69 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef KYTEA_PARALLEL_H_
+#define KYTEA_PARALLEL_H_
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kytea  {
+
+// Call func(i) for every i from 0 to size-1 on up to numThreads threads.
+// Each thread takes the next task that has not been started when it becomes
+// free, so tasks of very different sizes are balanced between the threads
+// (and putting the largest tasks first keeps a long task from starting last).
+// With one thread, the tasks are run in order on the calling thread. If a
+// task throws, the tasks that have not started are skipped and the first
+// exception is rethrown once all threads have finished.
+template <class Func>
+void parallelFor(unsigned numThreads, unsigned size, Func func) {
+    if(numThreads <= 1 || size <= 1) {
+        for(unsigned i = 0; i < size; i++)
+            func(i);
+        return;
+    }
+    std::atomic<unsigned> pos(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+        unsigned id;
+        while((id = pos++) < size) {
+            try {
+                func(id);
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error) error = std::current_exception();
+                pos = size;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < numThreads && i < size; i++)
+        workers.push_back(std::thread(worker));
+    worker();
+    for(unsigned i = 0; i < workers.size(); i++)
+        workers[i].join();
+    if(error)
+        std::rethrow_exception(error);
+}
+
+}
+
+#endif
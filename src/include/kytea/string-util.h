@@ -49,9 +49,27 @@ public:
     // A map that normalizes characters to a single representation
     GenericMap<KyteaChar,KyteaChar> * normMap_;
 
+    // A number that is different for every StringUtil that is created, even
+    //  if one is created at the address of another that was deleted
+    unsigned long serial_;
+    static unsigned long nextSerial();
+
+protected:
+
+    // The character of the type letter for each character id, and for each
+    // CharType (both built by freeze())
+    std::vector<KyteaChar> charTypeChars_;
+    std::vector<KyteaChar> typeChars_;
+
+    // Build the tables of type characters
+    void buildTypeTable();
+
+    // The characters of a string, which can be written directly
+    static KyteaChar * getChars(KyteaString & str) { return str.getWritableChars(); }
+
 public:
 
-    StringUtil() : normMap_(NULL) { }
+    StringUtil() : normMap_(NULL), serial_(nextSerial()) { }
 
     virtual ~StringUtil() {
         if(normMap_) delete normMap_;    
@@ -62,31 +80,62 @@ public:
     // an external synchronization is required.
     virtual KyteaChar mapChar(const std::string & str, bool add = true) = 0;
 
+    // Map a std::string to a character without changing the private members.
+    // Characters that have not been seen are mapped to a reserved id for
+    // their type, so this can be called from multiple threads at once.
+    virtual KyteaChar mapChar(const std::string & str) const = 0;
+
     virtual std::string showChar(KyteaChar c) const = 0;
 
-    std::string showString(const KyteaString & c) const {
-        std::ostringstream buff;
+    // Append the bytes of a character to a buffer, without building a
+    // std::string for it like showChar
+    virtual void appendChar(KyteaChar c, std::string & buff) const {
+        buff += showChar(c);
+    }
+
+    void appendString(const KyteaString & c, std::string & buff) const {
         for(unsigned i = 0; i < c.length(); i++)
-            buff << showChar(c[i]);
-        return buff.str();
+            appendChar(c[i], buff);
     }
 
-    std::string showEscapedString(const KyteaString & c, const KyteaString & spec, const std::string & bs) const {
-        std::ostringstream buff;
+    void appendEscapedString(const KyteaString & c, const KyteaString & spec, const std::string & bs, std::string & buff) const {
         for(unsigned i = 0; i < c.length(); i++) {
             if(spec.contains(c[i]))
-                buff << bs;
-            buff << showChar(c[i]);
+                buff += bs;
+            appendChar(c[i], buff);
         }
-        return buff.str();
+    }
+
+    std::string showString(const KyteaString & c) const {
+        std::string ret;
+        appendString(c, ret);
+        return ret;
+    }
+
+    std::string showEscapedString(const KyteaString & c, const KyteaString & spec, const std::string & bs) const {
+        std::string ret;
+        appendEscapedString(c, spec, bs, ret);
+        return ret;
     }
 
     // Map an unparsed std::string to a KyteaString.
     // Note that this operation requires an external synchronization.
     virtual KyteaString mapString(const std::string & str) = 0;
 
+    // Map an unparsed std::string to a KyteaString using the const mapChar.
+    // This requires no synchronization.
+    virtual KyteaString mapString(const std::string & str) const = 0;
+
+    // Map len bytes starting at str, such as a line in an input buffer
+    virtual KyteaString mapString(const char * str, size_t len) {
+        return mapString(std::string(str, len));
+    }
+    virtual KyteaString mapString(const char * str, size_t len) const {
+        return mapString(std::string(str, len));
+    }
+
     // get the type of a character
-    virtual CharType findType(const std::string & str) = 0;
+    virtual CharType findType(const std::string & str) const = 0;
     virtual CharType findType(KyteaChar c) const = 0;
 
     // return the encoding provided by this util
@@ -100,6 +149,21 @@ public:
     // normalization functions
     virtual GenericMap<KyteaChar,KyteaChar> * getNormMap() = 0;
     KyteaString normalize(const KyteaString & str);
+    // the const version requires the normalization map to be built already
+    KyteaString normalize(const KyteaString & str) const;
+
+    // the serial number of this StringUtil (never 0)
+    unsigned long getSerial() const { return serial_; }
+
+    // the number of character ids that have been assigned so far
+    virtual unsigned getNumCharIds() const = 0;
+
+    // Build all lazily initialized members. After this, the const functions
+    // can be used to share a single StringUtil between threads.
+    void freeze() {
+        getNormMap();
+        buildTypeTable();
+    }
 
     // Check that these are equal by serializing them
     void checkEqual(const StringUtil & rhs) const;
@@ -111,12 +175,22 @@ public:
 
     // get a std::string of character types
     std::string getTypeString(const KyteaString& str) const {
-        std::ostringstream buff;
+        std::string ret;
+        getTypeString(str, ret);
+        return ret;
+    }
+    // the same, but write into a buffer that can be reused
+    void getTypeString(const KyteaString& str, std::string & ret) const {
+        ret.resize(str.length());
         for(unsigned i = 0; i < str.length(); i++)
-            buff << findType(str[i]);
-        return buff.str();
+            ret[i] = findType(str[i]);
     }
 
+    // Get the character types as a KyteaString, which is equal to
+    // mapString(getTypeString(str)) but does not need the intermediate
+    // std::string. This is done in one pass over the table built by freeze().
+    KyteaString getTypeKyteaString(const KyteaString& str) const;
+
 
 };
 
@@ -134,30 +208,62 @@ private:
     std::vector<std::string> charNames_;
     std::vector<CharType> charTypes_;
 
+    // The ids of characters by their code points, in a flat table for the
+    // basic multilingual plane and a hash for the supplementary planes.
+    // Zero means that the character has no id yet. Only characters that are
+    // encoded in the shortest form are found here, others by charIds_.
+    std::vector<KyteaChar> bmpIds_;
+    GenericMap<unsigned,KyteaChar> suppIds_;
+
+    // add a character to the code point tables
+    void addCodePoint(const std::string & str, KyteaChar id);
+    KyteaChar findCodePoint(unsigned cp) const {
+        if(cp < 0x10000)
+            return bmpIds_[cp];
+        GenericMap<unsigned,KyteaChar>::const_iterator it = suppIds_.find(cp);
+        return (it == suppIds_.end() ? 0 : it->second);
+    }
+
+    // Decode len bytes into characters. Characters are found by their code
+    // points, and the rest are mapped with util.mapChar
+    template <class Util>
+    static KyteaString mapUtf8String(Util & util, const char * str, size_t len);
+
 public:
 
+    // The ids starting at UNKNOWN_BASE are reserved for characters that were
+    // not found by the const mapChar, one for each character type
+    const static KyteaChar UNKNOWN_BASE = 0xFFF0;
+
     StringUtilUtf8();
 
     ~StringUtilUtf8() { }
     
     // map a std::string to a character
     KyteaChar mapChar(const std::string & str, bool add = true) override;
+    KyteaChar mapChar(const std::string & str) const override;
+    // reserved characters are shown as the replacement character U+FFFD
     std::string showChar(KyteaChar c) const override;
+    void appendChar(KyteaChar c, std::string & buff) const override;
 
     CharType findType(KyteaChar c) const override;
 
     GenericMap<KyteaChar,KyteaChar> * getNormMap() override;
 
-    bool badu(char val) const { return ((val ^ maskl1) & maskl2); }
+    static bool badu(char val) { return ((val ^ maskl1) & maskl2); }
     KyteaString mapString(const std::string & str) override;
+    KyteaString mapString(const std::string & str) const override;
+    KyteaString mapString(const char * str, size_t len) override;
+    KyteaString mapString(const char * str, size_t len) const override;
 
     // find the type of a unicode character
-    CharType findType(const std::string & str) override;
+    CharType findType(const std::string & str) const override;
 
     Encoding getEncoding() const override { return ENCODING_UTF8; }
     const char* getEncodingString() const override { return "utf8"; }
 
     const std::vector<std::string> & getCharNames() const { return charNames_; }
+    unsigned getNumCharIds() const override { return charNames_.size(); }
 
     // transform to or from a character std::string
     void unserialize(const std::string & str) override;
@@ -175,18 +281,26 @@ public:
     StringUtilEuc() { };
     ~StringUtilEuc() { }
 
+    // characters are stored by their encoding, so mapping never adds
     KyteaChar mapChar(const std::string & str, bool add = true) override;
+    KyteaChar mapChar(const std::string & str) const override;
     std::string showChar(KyteaChar c) const override;
+    void appendChar(KyteaChar c, std::string & buff) const override;
     
     GenericMap<KyteaChar,KyteaChar> * getNormMap() override;
 
     // map an unparsed std::string to a KyteaString
+    using StringUtil::mapString;
     KyteaString mapString(const std::string & str) override;
+    KyteaString mapString(const std::string & str) const override;
 
     // get the type of a character
-    CharType findType(const std::string & str) override;
+    CharType findType(const std::string & str) const override;
     CharType findType(KyteaChar c) const override;
 
+    // every 16-bit value is the id of its own encoding
+    unsigned getNumCharIds() const override { return 0x10000; }
+
     // return the encoding provided by this util
     Encoding getEncoding() const override;
     const char* getEncodingString() const override;
@@ -207,18 +321,26 @@ public:
     StringUtilSjis() { };
     ~StringUtilSjis() { }
 
+    // characters are stored by their encoding, so mapping never adds
     KyteaChar mapChar(const std::string & str, bool add = true) override;
+    KyteaChar mapChar(const std::string & str) const override;
     GenericMap<KyteaChar,KyteaChar> * getNormMap() override;
 
     std::string showChar(KyteaChar c) const override;
+    void appendChar(KyteaChar c, std::string & buff) const override;
     
     // map an unparsed std::string to a KyteaString
+    using StringUtil::mapString;
     KyteaString mapString(const std::string & str) override;
+    KyteaString mapString(const std::string & str) const override;
 
     // get the type of a character
-    CharType findType(const std::string & str) override;
+    CharType findType(const std::string & str) const override;
     CharType findType(KyteaChar c) const override;
 
+    // every 16-bit value is the id of its own encoding
+    unsigned getNumCharIds() const override { return 0x10000; }
+
     // return the encoding provided by this util
     Encoding getEncoding() const override;
     const char* getEncodingString() const override;
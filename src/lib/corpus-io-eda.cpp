@@ -18,24 +18,27 @@ KyteaSentence * EdaCorpusIO::readSentence() {
 }
 
 void EdaCorpusIO::writeSentence(const KyteaSentence * sent, double conf) {
-    ostringstream oss;
-    oss << "ID=" << ++id_ << endl;
+    outBuff_ += "ID=";
+    appendNumber(++id_);
+    outBuff_ += '\n';
     for(unsigned i = 0; i < sent->words.size(); i++) {
         const KyteaWord & w = sent->words[i];
-        // Find the POS tag
-        string tag = "UNK";
-        if(w.getNumTags() >= 1) {
-            const vector< KyteaTag > & tags = w.getTags(0);
-            if(tags.size() > 0)
-                tag = util_->showString(tags[0].first);
-        }
         // Print
-        oss << i+1 << " " 
-            << i+2 << " "
-            << util_->showString(w.surface) << " "
-            << tag << " 0" << endl;
+        appendNumber((int)i+1);
+        outBuff_ += ' ';
+        appendNumber((int)i+2);
+        outBuff_ += ' ';
+        util_->appendString(w.surface, outBuff_);
+        outBuff_ += ' ';
+        // Find the POS tag
+        if(w.getNumTags() >= 1 && w.getTags(0).size() > 0)
+            util_->appendString(w.getTags(0)[0].first, outBuff_);
+        else
+            outBuff_ += "UNK";
+        outBuff_ += " 0\n";
     }
-    *str_ << oss.str() << endl;
+    outBuff_ += '\n';
+    finishSentence();
 }
 
 EdaCorpusIO::EdaCorpusIO(StringUtil * util) : CorpusIO(util), id_(0) { }
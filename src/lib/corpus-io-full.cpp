@@ -17,13 +17,13 @@ KyteaSentence * FullCorpusIO::readSentence() {
     if(out_ || !str_) 
         THROW_ERROR("Attempted to read a sentence from an closed or output object");
 #endif
-    string s;
-    getline(*str_, s);
-    if(str_->eof())
+    const char * line;
+    size_t lineLen;
+    if(!readLine(line, lineLen))
         return 0;
 
     KyteaChar spaceChar = bounds_[0], slashChar = bounds_[1], ampChar = bounds_[2], bsChar = bounds_[3];
-    KyteaString ks = util_->mapString(s), buff(ks.length());
+    KyteaString ks = util_->mapString(line, lineLen), buff(ks.length());
     int len = ks.length();
     KyteaSentence * ret = new KyteaSentence();
     int charLen = 0;
@@ -35,9 +35,9 @@ KyteaSentence * FullCorpusIO::readSentence() {
         bpos = 0;
         for( ; j < len && ks[j] != spaceChar && ks[j] != slashChar; j++) {
             if(ks[j] == ampChar) {
-                THROW_ERROR("Illegal tag separator in word position at "<<s);
+                THROW_ERROR("Illegal tag separator in word position at "<<string(line, lineLen));
             } else if(ks[j] == bsChar && ++j == len) {
-                THROW_ERROR("Illegal trailing escape character at "<<s);
+                THROW_ERROR("Illegal trailing escape character at "<<string(line, lineLen));
             }
             buff[bpos++] = ks[j];
         }
@@ -45,7 +45,7 @@ KyteaSentence * FullCorpusIO::readSentence() {
             if(ks[j] == spaceChar)
                 continue;
             else
-                THROW_ERROR("Empty word at position "<<j<<" in "<<s);
+                THROW_ERROR("Empty word at position "<<j<<" in "<<string(line, lineLen));
         }
         KyteaString word_str = buff.substr(0,bpos);
         KyteaWord word(word_str, util_->normalize(word_str));
@@ -57,7 +57,7 @@ KyteaSentence * FullCorpusIO::readSentence() {
             bpos = 0;
             for(++j ; j < len && ks[j] != spaceChar && ks[j] != slashChar && ks[j] != ampChar; j++) {
                 if(ks[j] == bsChar && ++j == len)
-                    THROW_ERROR("Illegal trailing escape character at "<<s);
+                    THROW_ERROR("Illegal trailing escape character at "<<string(line, lineLen));
                 buff[bpos++] = ks[j];
             }
             if(bpos != 0)
@@ -83,26 +83,37 @@ KyteaSentence * FullCorpusIO::readSentence() {
     return ret;
 }
 
-void FullCorpusIO::writeSentence(const KyteaSentence * sent, double conf) {
-    const string & wb = util_->showChar(bounds_[0]), tb = util_->showChar(bounds_[1]), eb = util_->showChar(bounds_[2]), bs = util_->showChar(bounds_[3]);
+void FullCorpusIO::appendWords(const KyteaSentence * sent) {
+    if(boundStrs_.empty())
+        for(unsigned i = 0; i < bounds_.length(); i++)
+            boundStrs_.push_back(util_->showChar(bounds_[i]));
+    const string & wb = boundStrs_[0], & tb = boundStrs_[1], & eb = boundStrs_[2], & bs = boundStrs_[3];
     for(unsigned i = 0; i < sent->words.size(); i++) {
-        if(i != 0) *str_ << wb;
+        if(i != 0) outBuff_ += wb;
         const KyteaWord & w = sent->words[i];
-        if(printWords_) *str_ << util_->showEscapedString(w.surface, bounds_, bs);
+        if(printWords_) util_->appendEscapedString(w.surface, bounds_, bs, outBuff_);
         int printed = 0;
         for(int j = 0; j < w.getNumTags(); j++) {
             const vector< KyteaTag > & tags = w.getTags(j);
             if(tags.size() > 0) {
-                *str_ << ((printWords_ || printed++ > 0) ? tb : "") << util_->showString(tags[0].first);
+                if(printWords_ || printed++ > 0) outBuff_ += tb;
+                util_->appendString(tags[0].first, outBuff_);
                 if(allTags_) 
-                    for(unsigned k = 1; k < tags.size(); k++) 
-                        *str_ << eb << util_->showString(tags[k].first);
+                    for(unsigned k = 1; k < tags.size(); k++) {
+                        outBuff_ += eb;
+                        util_->appendString(tags[k].first, outBuff_);
+                    }
             }
         }
         if(w.getUnknown())
-            *str_ << unkTag_;
+            outBuff_ += unkTag_;
     }
-    *str_ << endl;
+    outBuff_ += '\n';
+}
+
+void FullCorpusIO::writeSentence(const KyteaSentence * sent, double conf) {
+    appendWords(sent);
+    finishSentence();
 }
 
 FullCorpusIO::FullCorpusIO(StringUtil * util, const char* wordBound, const char* tagBound, const char* elemBound, const char* escape) : CorpusIO(util), allTags_(false), bounds_(4), printWords_(true) { 
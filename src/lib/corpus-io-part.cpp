@@ -17,11 +17,11 @@ KyteaSentence * PartCorpusIO::readSentence() {
     if(out_ || !str_) 
         THROW_ERROR("Attempted to read a sentence from an closed or output object");
 #endif
-    string s;
-    getline(*str_, s);
-    if(str_->eof())
+    const char * line;
+    size_t lineLen;
+    if(!readLine(line, lineLen))
         return 0;
-    KyteaString ks = util_->mapString(s), buff(ks.length());
+    KyteaString ks = util_->mapString(line, lineLen), buff(ks.length());
     KyteaChar ukBound = bounds_[0], skipBound = bounds_[1], noBound = bounds_[2], 
         hasBound = bounds_[3], slashChar = bounds_[4], elemChar = bounds_[5], 
         escapeChar = bounds_[6];
@@ -34,9 +34,9 @@ KyteaSentence * PartCorpusIO::readSentence() {
         // read in a word
         for( ; j < len; j++) {
             if(ks[j] == ukBound || ks[j] == skipBound || ks[j] == noBound || ks[j] == hasBound || ks[j] == slashChar || ks[j] == elemChar)
-                THROW_ERROR("Misplaced character '"<<util_->showChar(ks[j])<<"' in "<<s);
+                THROW_ERROR("Misplaced character '"<<util_->showChar(ks[j])<<"' in "<<string(line, lineLen));
             if(ks[j] == escapeChar && ++j >= len)
-                THROW_ERROR("Misplaced escape at the end of "<<s);
+                THROW_ERROR("Misplaced escape at the end of "<<string(line, lineLen));
             buff[bpos++] = ks[j++];
             if(j >= len || ks[j] == slashChar || ks[j] == hasBound) 
                 break;
@@ -44,7 +44,7 @@ KyteaSentence * PartCorpusIO::readSentence() {
                 ret->wsConfs.push_back(PROB_UNKNOWN);
                 cert = false;
             } else if(ks[j] != noBound) {
-                THROW_ERROR("Misplaced character '"<<util_->showChar(ks[j])<<"' in "<<s);
+                THROW_ERROR("Misplaced character '"<<util_->showChar(ks[j])<<"' in "<<string(line, lineLen));
             } else
                 ret->wsConfs.push_back(PROB_FALSE);
         }
@@ -60,7 +60,7 @@ KyteaSentence * PartCorpusIO::readSentence() {
             bpos = 0;
             for(++j ; j < len && ks[j] != hasBound && ks[j] != slashChar && ks[j] != elemChar; j++) {
                 if(ks[j] == escapeChar && ++j == len)
-                    THROW_ERROR("Illegal trailing escape character at "<<s);
+                    THROW_ERROR("Illegal trailing escape character at "<<string(line, lineLen));
                 buff[bpos++] = ks[j];
             }
             if(bpos != 0)
@@ -86,34 +86,37 @@ KyteaSentence * PartCorpusIO::readSentence() {
 
 void PartCorpusIO::writeSentence(const KyteaSentence * sent, double conf)  {
     unsigned curr = 0;
-    const string & ukBound = util_->showChar(bounds_[0]), & skipBound = util_->showChar(bounds_[1]), 
-        &noBound = util_->showChar(bounds_[2]), &hasBound = util_->showChar(bounds_[3]), 
-        &slashChar = util_->showChar(bounds_[4]), &elemChar = util_->showChar(bounds_[5]);
+    const string ukBound = util_->showChar(bounds_[0]), skipBound = util_->showChar(bounds_[1]), 
+        noBound = util_->showChar(bounds_[2]), hasBound = util_->showChar(bounds_[3]), 
+        slashChar = util_->showChar(bounds_[4]), elemChar = util_->showChar(bounds_[5]);
     for(unsigned i = 0; i < sent->words.size(); i++) {
         const KyteaWord & w = sent->words[i];
-        string sepType = ukBound;
+        const string * sepType = &ukBound;
         for(unsigned j = 0; j < w.surface.length(); ) {
-            *str_ << util_->showChar(sent->surface[curr]);
-            if(curr == sent->wsConfs.size()) sepType = skipBound;
-            else if(sent->wsConfs[curr] > conf) sepType = hasBound;
-            else if(sent->wsConfs[curr] < conf*-1) sepType = noBound;
-            else sepType = ukBound;
+            util_->appendChar(sent->surface[curr], outBuff_);
+            if(curr == sent->wsConfs.size()) sepType = &skipBound;
+            else if(sent->wsConfs[curr] > conf) sepType = &hasBound;
+            else if(sent->wsConfs[curr] < conf*-1) sepType = &noBound;
+            else sepType = &ukBound;
             if(++j != w.surface.length())
-                *str_ << sepType;
+                outBuff_ += *sepType;
             curr++;
         }
         for(int j = 0; j < w.getNumTags(); j++) {
             const vector<KyteaTag> & tags = w.getTags(j);
             for(int k = 0; k < (int)tags.size(); k++)
-                if(tags[k].second > conf)
-                    *str_ << (k==0?slashChar:elemChar) << util_->showString(tags[k].first);
+                if(tags[k].second > conf) {
+                    outBuff_ += (k==0?slashChar:elemChar);
+                    util_->appendString(tags[k].first, outBuff_);
+                }
         }
         if(w.getUnknown())
-            *str_ << unkTag_;
-        if(sepType != skipBound)
-            *str_ << sepType;
+            outBuff_ += unkTag_;
+        if(*sepType != skipBound)
+            outBuff_ += *sepType;
     }
-    *str_ << endl;
+    outBuff_ += '\n';
+    finishSentence();
 }
 
 PartCorpusIO::PartCorpusIO(StringUtil * util, const char* unkBound, const char* skipBound, const char* noBound, const char* hasBound, const char* tagBound, const char* elemBound, const char* escape) : CorpusIO(util), bounds_(7) { 
@@ -23,7 +23,7 @@ KyteaSentence * ProbCorpusIO::readSentence() {
         return 0;
     // get the ws confidences
     string s;
-    getline(*str_, s);
+    readLine(s);
     istringstream wsiss(s);
     KyteaSentence::Floats::iterator wsit = ret->wsConfs.begin();
     while((wsiss >> s) && (wsit != ret->wsConfs.end())) {
@@ -35,7 +35,7 @@ KyteaSentence * ProbCorpusIO::readSentence() {
     }
     // get the pe confidences
     for(int i = 0; i < getNumTags(); i++) {
-        getline(*str_, s);
+        readLine(s);
         istringstream peiss(s);
         KyteaSentence::Words::iterator peit = ret->words.begin();
         while((peiss >> s) && (peit != ret->words.end())) {
@@ -48,7 +48,7 @@ KyteaSentence * ProbCorpusIO::readSentence() {
         }
     }
     // get the separator line
-    getline(*str_, s);
+    readLine(s);
     if(s.length())
         THROW_ERROR("Badly formatted probability file (no white-space between sentences)");
 
@@ -56,28 +56,31 @@ KyteaSentence * ProbCorpusIO::readSentence() {
 }
 
 void ProbCorpusIO::writeSentence(const KyteaSentence * sent, double conf)  {
-    FullCorpusIO::writeSentence(sent, conf);
-    const string & space = util_->showChar(bounds_[0]), &amp = util_->showChar(bounds_[2]);
+    appendWords(sent);
+    const string & space = boundStrs_[0], &amp = boundStrs_[2];
     for(unsigned i = 0; i < sent->wsConfs.size(); i++) {
-        if(i != 0) *str_ << space;
-        *str_ << abs(sent->wsConfs[i]);
+        if(i != 0) outBuff_ += space;
+        appendNumber(abs(sent->wsConfs[i]));
     }
-    *str_ << endl;
+    outBuff_ += '\n';
     for(int k = 0; k < getNumTags(); k++) {
         if(getDoTag(k)) {
             for(unsigned i = 0; i < sent->words.size(); i++) {
-                if(i != 0) *str_ << space;
+                if(i != 0) outBuff_ += space;
                 const vector< KyteaTag > & tags = sent->words[i].getTags(k);
                 if(tags.size() > 0) {
-                    *str_ << tags[0].second;
+                    appendNumber(tags[0].second);
                     if(allTags_)
-                        for(unsigned j = 1; j < tags.size(); j++)
-                            *str_ << amp << tags[j].second;
+                        for(unsigned j = 1; j < tags.size(); j++) {
+                            outBuff_ += amp;
+                            appendNumber(tags[j].second);
+                        }
                 } else
-                    *str_ << 0;
+                    appendNumber(0);
             }
-            *str_ << endl;
+            outBuff_ += '\n';
         }
     }
-    *str_ << endl;
+    outBuff_ += '\n';
+    finishSentence();
 }
@@ -16,12 +16,12 @@ KyteaSentence * RawCorpusIO::readSentence() {
     if(out_ || !str_) 
         THROW_ERROR("Attempted to read a sentence from an closed or output object");
 #endif
-    string s;
-    getline(*str_, s);
-    if(str_->eof())
+    const char * line;
+    size_t lineLen;
+    if(!readLine(line, lineLen))
         return 0;
     KyteaSentence * ret = new KyteaSentence();
-    ret->surface = util_->mapString(s);
+    ret->surface = util_->mapString(line, lineLen);
     ret->norm = util_->normalize(ret->surface);
     if(ret->surface.length() != 0)
         ret->wsConfs.resize(ret->surface.length()-1,0);
@@ -29,5 +29,7 @@ KyteaSentence * RawCorpusIO::readSentence() {
 }
 
 void RawCorpusIO::writeSentence(const KyteaSentence * sent, double conf)  {
-    *str_ << util_->showString(sent->surface) << endl;
+    util_->appendString(sent->surface, outBuff_);
+    outBuff_ += '\n';
+    finishSentence();
 }
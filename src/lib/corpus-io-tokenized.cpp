@@ -17,13 +17,13 @@ KyteaSentence * TokenizedCorpusIO::readSentence() {
     if(out_ || !str_) 
         THROW_ERROR("Attempted to read a sentence from an closed or output object");
 #endif
-    string s;
-    getline(*str_, s);
-    if(str_->eof())
+    const char * line;
+    size_t lineLen;
+    if(!readLine(line, lineLen))
         return 0;
 
     KyteaChar spaceChar = bounds_[0];
-    KyteaString ks = util_->mapString(s), buff(ks.length());
+    KyteaString ks = util_->mapString(line, lineLen), buff(ks.length());
     int len = ks.length();
     KyteaSentence * ret = new KyteaSentence();
     int charLen = 0;
@@ -39,7 +39,7 @@ KyteaSentence * TokenizedCorpusIO::readSentence() {
             if(ks[j] == spaceChar)
                 continue;
             else
-                THROW_ERROR("Empty word at position "<<j<<" in "<<s);
+                THROW_ERROR("Empty word at position "<<j<<" in "<<string(line, lineLen));
         }
         KyteaString word_str = buff.substr(0,bpos);
         KyteaWord word(word_str, util_->normalize(word_str));
@@ -67,13 +67,14 @@ KyteaSentence * TokenizedCorpusIO::readSentence() {
 void TokenizedCorpusIO::writeSentence(const KyteaSentence * sent, double conf) {
     const string & wb = util_->showChar(bounds_[0]);
     for(unsigned i = 0; i < sent->words.size(); i++) {
-        if(i != 0) *str_ << wb;
+        if(i != 0) outBuff_ += wb;
         const KyteaWord & w = sent->words[i];
-        *str_ << util_->showString(w.surface);
+        util_->appendString(w.surface, outBuff_);
         if(w.getUnknown())
-            *str_ << unkTag_;
+            outBuff_ += unkTag_;
     }
-    *str_ << endl;
+    outBuff_ += '\n';
+    finishSentence();
 }
 
 TokenizedCorpusIO::TokenizedCorpusIO(StringUtil * util, const char* wordBound) : CorpusIO(util), bounds_(1) { 
@@ -24,6 +24,7 @@
 #include <kytea/corpus-io-prob.h>
 #include <kytea/corpus-io-raw.h>
 #include <cmath>
+#include <cstdio>
 #include "config.h"
 
 #define PROB_TRUE    100.0
@@ -33,6 +34,41 @@
 using namespace kytea;
 using namespace std;
 
+void CorpusIO::flush() {
+    if(outBuff_.size() == 0)
+        return;
+    str_->write(outBuff_.data(), outBuff_.size());
+    str_->flush();
+    outBuff_.clear();
+}
+
+bool CorpusIO::readLine(const char *& line, size_t & len) {
+    if(reader_ == 0 || reader_->getStream() != str_) {
+        if(reader_) delete reader_;
+        reader_ = new LineReader(*str_);
+    }
+    return reader_->readLine(line, len);
+}
+bool CorpusIO::readLine(string & line) {
+    const char * buff;
+    size_t len;
+    bool ret = readLine(buff, len);
+    line.assign(buff ? buff : "", len);
+    return ret;
+}
+
+void CorpusIO::appendNumber(double val) {
+    // the same as writing to the stream with its default format
+    char buff[64];
+    snprintf(buff, sizeof(buff), "%.*g", (int)str_->precision(), val);
+    outBuff_ += buff;
+}
+void CorpusIO::appendNumber(int val) {
+    char buff[16];
+    snprintf(buff, sizeof(buff), "%d", val);
+    outBuff_ += buff;
+}
+
 CorpusIO * CorpusIO::createIO(const char* file, CorpusFormat form, const KyteaConfig & conf, bool output, StringUtil* util) {
     switch (form) {
         case CORP_FORMAT_FULL:
@@ -5,6 +5,7 @@
 #include <kytea/string-util.h>
 #include <kytea/feature-vector.h>
 #include <iostream>
+#include <algorithm>
 
 using namespace kytea;
 using namespace std;
@@ -29,28 +30,145 @@ double ProbTagEntry::incrementProb(const KyteaString & str, int lev) {
     THROW_ERROR("Attempt to increment a non-existent tag string");
 }
 
+const uint32_t DictionaryAutomaton::EMPTY;
+
+void DictionaryAutomaton::build(const vector<DictionaryState*> & states) {
+    // The position of each state in the double array
+    vector<uint32_t> pos(states.size(), 0);
+    vector<uint32_t> base(1, 0), check(1, EMPTY);
+    // The first position that may be free. Positions before this are mostly
+    // used, and are not searched again
+    unsigned nextCheck = 1;
+    // States with many children rarely fit into the space left by earlier
+    // states, so the search for each number of children (on a log scale)
+    // starts where the last state of that size was placed
+    vector<unsigned> sizeCheck(sizeof(unsigned)*8, 1);
+    deque<unsigned> sq(1, 0);
+    while(sq.size() != 0) {
+        unsigned s = sq.front();
+        sq.pop_front();
+        const DictionaryState::Gotos & gotos = states[s]->gotos;
+        if(gotos.size() == 0)
+            continue;
+        // Find the first base where all of the children fit
+        const unsigned first = gotos[0].first, last = gotos.back().first;
+        unsigned sizeId = 0;
+        while((2u << sizeId) <= gotos.size()) sizeId++;
+        unsigned start = max(nextCheck, sizeCheck[sizeId]);
+        unsigned p = max(start, first+1), numUsed = 0, b = 0;
+        while(true) {
+            if(check.size() <= p+last-first) {
+                check.resize(p+last-first+1, EMPTY);
+                base.resize(check.size(), 0);
+            }
+            if(check[p] != EMPTY) {
+                numUsed++;
+            } else {
+                b = p-first;
+                unsigned j;
+                for(j = 1; j < gotos.size() && check[b+gotos[j].first] == EMPTY; j++);
+                if(j == gotos.size()) break;
+            }
+            p++;
+        }
+        if(numUsed >= 0.95*(p-start+1) && start == nextCheck)
+            nextCheck = p;
+        sizeCheck[sizeId] = p;
+        base[pos[s]] = b;
+        for(unsigned j = 0; j < gotos.size(); j++) {
+            unsigned t = b+gotos[j].first;
+            check[t] = pos[s];
+            pos[gotos[j].second] = t;
+            sq.push_back(gotos[j].second);
+        }
+    }
+    // Put the failures and outputs at the same positions
+    vector<int> stateAt(check.size(), -1);
+    for(unsigned i = 0; i < states.size(); i++)
+        stateAt[pos[i]] = i;
+    vector<uint32_t> fails(check.size(), 0), oStarts(check.size()+1), outs;
+    vector<unsigned char> branch(check.size(), 0);
+    for(unsigned i = 0; i < check.size(); i++) {
+        oStarts[i] = outs.size();
+        if(stateAt[i] < 0) continue;
+        const DictionaryState & state = *states[stateAt[i]];
+        fails[i] = pos[state.failure];
+        outs.insert(outs.end(), state.output.begin(), state.output.end());
+        branch[i] = state.isBranch;
+    }
+    oStarts[check.size()] = outs.size();
+    bases.assign(base);
+    checks.assign(check);
+    failures.assign(fails);
+    outputStarts.assign(oStarts);
+    outputs.assign(outs);
+    branches.assign(branch);
+    numStates = states.size();
+}
+
+void DictionaryAutomaton::getStates(vector<DictionaryState> & states) const {
+    states.clear();
+    if(numStates == 0)
+        return;
+    // Find the children of every position
+    vector<DictionaryState::Gotos> gotos(checks.size());
+    for(unsigned t = 1; t < checks.size(); t++)
+        if(checks[t] != EMPTY)
+            gotos[checks[t]].push_back(pair<KyteaChar,unsigned>(t-bases[checks[t]], t));
+    // Number the states in breadth-first order
+    vector<uint32_t> ids(checks.size(), 0), order(1, 0);
+    for(unsigned i = 0; i < order.size(); i++) {
+        const DictionaryState::Gotos & g = gotos[order[i]];
+        for(unsigned j = 0; j < g.size(); j++) {
+            ids[g[j].second] = order.size();
+            order.push_back(g[j].second);
+        }
+    }
+    states.resize(order.size());
+    for(unsigned i = 0; i < order.size(); i++) {
+        unsigned p = order[i];
+        DictionaryState & state = states[i];
+        state.failure = ids[failures[p]];
+        state.gotos = gotos[p];
+        for(unsigned j = 0; j < state.gotos.size(); j++)
+            state.gotos[j].second = ids[state.gotos[j].second];
+        state.output.assign(outputs.data()+outputStarts[p], outputs.data()+outputStarts[p+1]);
+        state.isBranch = branches[p];
+    }
+}
+
+void DictionaryAutomaton::clear() {
+    bases.clear();
+    checks.clear();
+    failures.clear();
+    outputStarts.clear();
+    outputs.clear();
+    branches.clear();
+    numStates = 0;
+}
+
 // This is only a light check to make sure the number of states
 // and entries are identical for now, if necessary expand to check
 // the values as well
 template <class Entry>
 void Dictionary<Entry>::checkEqual(const Dictionary<Entry> & rhs) const {
-    if(states_.size() != rhs.states_.size())
-        THROW_ERROR("states_.size() != rhs.states_.size() ("<<states_.size()<<" != "<<rhs.states_.size());
-    if(entries_.size() != rhs.entries_.size())
-        THROW_ERROR("entries_.size() != rhs.entries_.size() ("<<entries_.size()<<" != "<<rhs.entries_.size());
+    if(getNumStates() != rhs.getNumStates())
+        THROW_ERROR("getNumStates() != rhs.getNumStates() ("<<getNumStates()<<" != "<<rhs.getNumStates());
+    if(getNumEntries() != rhs.getNumEntries())
+        THROW_ERROR("getNumEntries() != rhs.getNumEntries() ("<<getNumEntries()<<" != "<<rhs.getNumEntries());
     if(numDicts_ != rhs.numDicts_)
         THROW_ERROR("numDicts_ != rhs.numDicts_ ("<<numDicts_<<" != "<<rhs.numDicts_);
 }
 
 template <class Entry>
-void Dictionary<Entry>::buildGoto(wm_const_iterator start, wm_const_iterator end, unsigned lev, unsigned nid) {
+void Dictionary<Entry>::buildGoto(vector<DictionaryState*> & states, wm_const_iterator start, wm_const_iterator end, unsigned lev, unsigned nid) {
 #ifdef KYTEA_SAFE
     if(start == end) return;
-    if(nid >= states_.size())
-        THROW_ERROR("Out of bounds node in buildGoto ("<<nid<<" >= "<<states_.size()<<")");
+    if(nid >= states.size())
+        THROW_ERROR("Out of bounds node in buildGoto ("<<nid<<" >= "<<states.size()<<")");
 #endif
     wm_const_iterator startCopy = start;
-    DictionaryState & node = *states_[nid];
+    DictionaryState & node = *states[nid];
     // add equal strings
     if(startCopy->first.length() == lev) {
         node.output.push_back(entries_.size());
@@ -79,10 +197,10 @@ void Dictionary<Entry>::buildGoto(wm_const_iterator start, wm_const_iterator end
         binEnd++;
         KyteaChar nextChar = (binEnd == end?0:binEnd->first[lev]);
         if(nextChar != lastChar) {
-            unsigned nextNode = states_.size();
-            states_.push_back(new DictionaryState());
+            unsigned nextNode = states.size();
+            states.push_back(new DictionaryState());
             node.gotos.push_back(std::pair<KyteaChar,unsigned>(lastChar,nextNode));
-            buildGoto(binStart,binEnd,lev+1,nextNode);
+            buildGoto(states,binStart,binEnd,lev+1,nextNode);
             binStart = binEnd;
             lastChar = nextChar;
         }
@@ -90,28 +208,28 @@ void Dictionary<Entry>::buildGoto(wm_const_iterator start, wm_const_iterator end
 }
 
 template <class Entry>
-void Dictionary<Entry>::buildFailures() {
-    if(states_.size() == 0)
+void Dictionary<Entry>::buildFailures(vector<DictionaryState*> & states) {
+    if(states.size() == 0)
         return;
     std::deque<unsigned> sq;
-    DictionaryState::Gotos & g0 = states_[0]->gotos;
+    DictionaryState::Gotos & g0 = states[0]->gotos;
     for(unsigned i = 0; i < g0.size(); i++)
         sq.push_back(g0[i].second);
     while(sq.size() != 0) {
         unsigned r = sq.front();
         sq.pop_front();
-        DictionaryState::Gotos & gr = states_[r]->gotos;
+        DictionaryState::Gotos & gr = states[r]->gotos;
         for(unsigned i = 0; i < gr.size(); i++) {
             KyteaChar a = gr[i].first;
             unsigned s = gr[i].second;
             sq.push_back(s);
-            unsigned state = states_[r]->failure;
+            unsigned state = states[r]->failure;
             unsigned trans = 0;
-            while((trans = states_[state]->step(a)) == 0 && (state != 0))
-                state = states_[state]->failure;
-            states_[s]->failure = trans;
-            for(unsigned j = 0; j < states_[trans]->output.size(); j++)
-                states_[s]->output.push_back(states_[trans]->output[j]);
+            while((trans = states[state]->step(a)) == 0 && (state != 0))
+                state = states[state]->failure;
+            states[s]->failure = trans;
+            for(unsigned j = 0; j < states[trans]->output.size(); j++)
+                states[s]->output.push_back(states[trans]->output[j]);
         }
     }
 
@@ -119,12 +237,13 @@ void Dictionary<Entry>::buildFailures() {
 
 template <class Entry>
 void Dictionary<Entry>::clearData() {
-    for(unsigned i = 0; i < states_.size(); i++)
-        delete states_[i];
     for(unsigned i = 0; i < entries_.size(); i++)
         delete entries_[i];
     entries_.clear();
-    states_.clear();
+    automaton_.clear();
+    values_.clear();
+    valueSize_ = 0;
+    mapping_.reset();
 }
 
 template <class Entry>
@@ -132,9 +251,12 @@ void Dictionary<Entry>::buildIndex(const WordMap & input) {
     if(input.size() == 0)
         THROW_ERROR("Cannot build dictionary for no input");
     clearData();
-    states_.push_back(new DictionaryState());
-    buildGoto(input.begin(), input.end(), 0, 0);
-    buildFailures();
+    vector<DictionaryState*> states(1, new DictionaryState());
+    buildGoto(states, input.begin(), input.end(), 0, 0);
+    buildFailures(states);
+    automaton_.build(states);
+    for(unsigned i = 0; i < states.size(); i++)
+        delete states[i];
 }
 
 inline string showWord(StringUtil * util, const ModelTagEntry * entry) {
@@ -154,57 +276,58 @@ inline string showWord(StringUtil * util, const FeatVec * entry) {
 
 template <class Entry>
 void Dictionary<Entry>::print() {
-    for(unsigned i = 0; i < states_.size(); i++) {
-        std::cout << "s="<<i<<", f="<<states_[i]->failure<<", o='";
-        for(unsigned j = 0; j < states_[i]->output.size(); j++) {
+    std::vector<DictionaryState> states;
+    automaton_.getStates(states);
+    for(unsigned i = 0; i < states.size(); i++) {
+        const DictionaryState & state = states[i];
+        std::cout << "s="<<i<<", f="<<state.failure<<", o='";
+        for(unsigned j = 0; j < state.output.size(); j++) {
             if(j!=0) std::cout << " ";
-            // std::cout << util_->showString(entries_[states_[i]->output[j]]->word);
-            std::cout << showWord(util_, entries_[states_[i]->output[j]]);
+            // std::cout << util_->showString(entries_[state.output[j]]->word);
+            std::cout << showWord(util_, getEntry(state.output[j]));
         }
         std::cout << "' g='";
-        for(unsigned j = 0; j < states_[i]->gotos.size(); j++) {
+        for(unsigned j = 0; j < state.gotos.size(); j++) {
             if(j!=0) std::cout << " ";
-            std::cout << util_->showChar(states_[i]->gotos[j].first) << "->" << states_[i]->gotos[j].second;
+            std::cout << util_->showChar(state.gotos[j].first) << "->" << state.gotos[j].second;
         }
         std::cout << "'" << std::endl;
     }
 }
 
 template <class Entry>
-Entry * Dictionary<Entry>::findEntry(KyteaString str) {
-    if(str.length() == 0) return 0;
+int Dictionary<Entry>::findEntryId(const KyteaStringView & str) const {
+    if(str.length() == 0 || getNumStates() == 0) return -1;
     unsigned state = 0, lev = 0;
     do {
 #ifdef KYTEA_SAFE
-        if(state >= states_.size())
-            THROW_ERROR("Accessing state "<<state<<" that is larger than states_ ("<<states_.size()<<")");
-        if(states_[state] == 0)
-            THROW_ERROR("Accessing null state "<<state);
+        if(state >= automaton_.checks.size())
+            THROW_ERROR("Accessing state "<<state<<" that is larger than the automaton ("<<automaton_.checks.size()<<")");
 #endif
-        state = states_[state]->step(str[lev++]);
+        state = automaton_.step(state, str[lev++]);
     } while (state != 0 && lev < str.length());
-    if(states_[state]->output.size() == 0) return 0;
-    if(!states_[state]->isBranch) return 0;
-    return entries_[states_[state]->output[0]];
+    if(automaton_.outputStarts[state] == automaton_.outputStarts[state+1]) return -1;
+    if(!automaton_.branches[state]) return -1;
+    return automaton_.outputs[automaton_.outputStarts[state]];
 }
+
 template <class Entry>
-const Entry * Dictionary<Entry>::findEntry(KyteaString str) const {
-    if(str.length() == 0) return 0;
-    unsigned state = 0, lev = 0;
-    do {
-        state = states_[state]->step(str[lev++]);
-    } while (state != 0 && lev < str.length());
-    if(states_[state]->output.size() == 0) return 0;
-    if(!states_[state]->isBranch) return 0;
-    return entries_[states_[state]->output[0]];
+Entry * Dictionary<Entry>::findEntry(const KyteaStringView & str) {
+    int id = findEntryId(str);
+    return (id < 0 ? 0 : getEntry(id));
+}
+template <class Entry>
+const Entry * Dictionary<Entry>::findEntry(const KyteaStringView & str) const {
+    int id = findEntryId(str);
+    return (id < 0 ? 0 : getEntry(id));
 }
 
 template <>
-unsigned Dictionary<FeatVec>::getTagID(KyteaString str, KyteaString tag, int lev) {
+unsigned Dictionary<FeatVec>::getTagID(const KyteaStringView & str, const KyteaString & tag, int lev) {
     return 0;
 }
 template <class Entry>
-unsigned Dictionary<Entry>::getTagID(KyteaString str, KyteaString tag, int lev) {
+unsigned Dictionary<Entry>::getTagID(const KyteaStringView & str, const KyteaString & tag, int lev) {
     const Entry * ent = findEntry(str);
     if(ent == 0) return 0;
     for(unsigned i = 0; i < ent->tags[lev].size(); i++)
@@ -214,22 +337,55 @@ unsigned Dictionary<Entry>::getTagID(KyteaString str, KyteaString tag, int lev)
 }
 
 template <class Entry>
-typename Dictionary<Entry>::MatchResult Dictionary<Entry>::match( const KyteaString & chars ) const {
-    const unsigned len = chars.length();
-    unsigned currState = 0, nextState;
+void Dictionary<Entry>::matchIds( const KyteaStringView & chars, MatchIdResult & ret ) const {
+    ret.clear();
+    visitMatches(chars, [&ret](unsigned end, unsigned id) {
+        ret.push_back( std::pair<unsigned, unsigned>(end, id) );
+    });
+}
+
+template <class Entry>
+void Dictionary<Entry>::match( const KyteaStringView & chars, MatchResult & ret ) const {
+    ret.clear();
+    visitMatches(chars, [this, &ret](unsigned end, unsigned id) {
+        ret.push_back( std::pair<unsigned, Entry*>(end, getEntry(id)) );
+    });
+}
+
+template <class Entry>
+typename Dictionary<Entry>::MatchIdResult Dictionary<Entry>::matchIds( const KyteaStringView & chars ) const {
+    MatchIdResult ret;
+    matchIds(chars, ret);
+    return ret;
+}
+
+template <class Entry>
+typename Dictionary<Entry>::MatchResult Dictionary<Entry>::match( const KyteaStringView & chars ) const {
     MatchResult ret;
-    for(unsigned i = 0; i < len; i++) {
-        KyteaChar c = chars[i];
-        while((nextState = states_[currState]->step(c)) == 0 && currState != 0)
-            currState = states_[currState]->failure;
-        currState = nextState;
-        std::vector<unsigned> & output = states_[currState]->output;
-        for(unsigned j = 0; j < output.size(); j++) 
-            ret.push_back( std::pair<unsigned, Entry*>(i, entries_[output[j]]) );
-    }
+    match(chars, ret);
     return ret;
 }
 
+template <>
+const FeatVal * Dictionary<FeatVec>::getValues(unsigned id) const {
+    if(valueSize_)
+        return values_.data() + id*valueSize_;
+    FeatVec & vec = *getEntry(id);
+    return (vec.size() ? &vec[0] : 0);
+}
+template <>
+unsigned Dictionary<FeatVec>::getNumValues(unsigned id) const {
+    return (valueSize_ ? valueSize_ : getEntry(id)->size());
+}
+template <class Entry>
+const FeatVal * Dictionary<Entry>::getValues(unsigned id) const {
+    THROW_ERROR("Only dictionaries of feature vectors have values");
+}
+template <class Entry>
+unsigned Dictionary<Entry>::getNumValues(unsigned id) const {
+    THROW_ERROR("Only dictionaries of feature vectors have values");
+}
+
 template class Dictionary<ModelTagEntry>;
 template class Dictionary<ProbTagEntry>;
 template class Dictionary<FeatVec>;
@@ -3,11 +3,87 @@
 #include <kytea/kytea-util.h>
 #include <kytea/feature-io.h>
 #include <kytea/dictionary.h>
+#include <kytea/mapped-file.h>
 #include <fstream>
+#include <cstring>
+#include <stdint.h>
 
 using namespace kytea;
 using namespace std;
 
+// Reads the values of a binary feature file in order
+class FeatureReader {
+
+private:
+    const char * pos_, * end_;
+    const string & fileName_;
+
+public:
+    FeatureReader(const MappedFile & file, const string & fileName) :
+        pos_(file.getData()), end_(file.getData()+file.getSize()), fileName_(fileName) { }
+
+    bool atEnd() const { return pos_ == end_; }
+    const char * getPos() const { return pos_; }
+    void skip(size_t size) {
+        if((size_t)(end_-pos_) < size)
+            THROW_ERROR("Feature file "<<fileName_<<" is truncated");
+        pos_ += size;
+    }
+
+    template <class T>
+    void readArray(T * vals, size_t size) {
+        const char * start = pos_;
+        skip(sizeof(T)*size);
+        if(size > 0)
+            memcpy(vals, start, sizeof(T)*size);
+    }
+    template <class T>
+    T read() {
+        T val;
+        readArray(&val, 1);
+        return val;
+    }
+    template <class T>
+    void readVector(vector<T> & vals, size_t size) {
+        vals.resize(size);
+        readArray(size ? &vals[0] : (T*)0, size);
+    }
+
+    // Read a table of strings (see writeStrings)
+    void readStrings(vector<string> & strs) {
+        vector<uint32_t> offsets;
+        readVector(offsets, read<uint32_t>()+1);
+        const char * chars = pos_;
+        skip(offsets.back());
+        strs.resize(offsets.size()-1);
+        for(unsigned i = 0; i < strs.size(); i++) {
+            if(offsets[i] > offsets[i+1])
+                THROW_ERROR("Badly formed string table in feature file "<<fileName_);
+            strs[i].assign(chars+offsets[i], offsets[i+1]-offsets[i]);
+        }
+    }
+
+};
+
+// Write a table of strings as the number of strings, the offset of each
+//  string and the end of the last, and the characters of all the strings
+static void writeStrings(ostream & out, const vector<string> & strs) {
+    vector<uint32_t> offsets(1, 0);
+    for(unsigned i = 0; i < strs.size(); i++)
+        offsets.push_back(offsets.back()+strs[i].length());
+    uint32_t size = strs.size();
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(&offsets[0]), offsets.size()*sizeof(uint32_t));
+    for(unsigned i = 0; i < strs.size(); i++)
+        out.write(strs[i].c_str(), strs[i].length());
+}
+
+template <class T>
+static void writeArray(ostream & out, const vector<T> & vals) {
+    if(vals.size() > 0)
+        out.write(reinterpret_cast<const char*>(&vals[0]), vals.size()*sizeof(T));
+}
+
 FeatureIO::~FeatureIO() {
     if(out_) delete out_;
 }
@@ -16,6 +92,19 @@ void FeatureIO::load(const string& fileName,StringUtil* util) {
     ifstream in(fileName.c_str());
     if(in.fail())
         THROW_ERROR("Failed to open feature file "<<fileName);
+    string line;
+    getline(in, line);
+    if(line.compare(0, strlen(FEATURE_IO_BINARY_HEADER), FEATURE_IO_BINARY_HEADER) == 0) {
+        in.close();
+        loadBinary(fileName, util);
+    } else {
+        in.clear();
+        in.seekg(0);
+        loadText(in, util);
+    }
+}
+
+void FeatureIO::loadText(istream & in, StringUtil * util) {
     string line, str, str2;
     // load the dictionary
     unsigned char maxDict = 0;
@@ -63,7 +152,6 @@ void FeatureIO::load(const string& fileName,StringUtil* util) {
         }
         // make the structure
         TagTriplet * trip = new TagTriplet();
-        trip->first = vector< vector<unsigned> >();
         trip->second = vector<int>();
         trip->third = new KyteaModel();
         feats_.insert(pair<KyteaString,TagTriplet*>(util->mapString(line),trip));
@@ -84,20 +172,115 @@ void FeatureIO::load(const string& fileName,StringUtil* util) {
             istringstream iss(line);
             iss >> str; trip->second.push_back(util->parseInt(str.c_str()));
             // cerr << str;
-            vector<unsigned> x;
             while(iss >> str) {
-                x.push_back(util->parseInt(str.c_str()));
+                trip->first.addFeature(util->parseInt(str.c_str()));
                 // cerr << " " << util->showString(name) << "("<<id<<")";
             }
             // cerr << endl;
-            trip->first.push_back(x);
+            trip->first.endRow();
         }
     }
 }
 
-void FeatureIO::openOut(const string& fileName) {
+void FeatureIO::loadBinary(const string & fileName, StringUtil * util) {
+    MappedFile file(fileName.c_str());
+    FeatureReader in(file, fileName);
+    // check the encoding on the first line
+    const char * start = in.getPos();
+    while(in.read<char>() != '\n');
+    string enc(start, in.getPos()-start-1);
+    enc = enc.substr(min(enc.length(), strlen(FEATURE_IO_BINARY_HEADER)+1));
+    if(enc != util->getEncodingString())
+        THROW_ERROR("Feature file "<<fileName<<" is in the "<<enc<<" encoding, but "<<util->getEncodingString()<<" is being used");
+    // load the dictionary
+    numTags_ = in.read<uint32_t>();
+    vector<string> words;
+    in.readStrings(words);
+    vector<unsigned char> inDicts;
+    in.readVector(inDicts, words.size());
+    vector< vector<uint32_t> > numTypes(numTags_);
+    vector< vector<string> > tags(numTags_);
+    vector< vector<unsigned char> > tagInDicts(numTags_);
+    for(int j = 0; j < numTags_; j++) {
+        in.readVector(numTypes[j], words.size());
+        in.readStrings(tags[j]);
+        in.readVector(tagInDicts[j], tags[j].size());
+    }
+    // the strings are mapped in the same order as in the text format
+    unsigned char maxDict = 0;
+    vector<unsigned> tagPos(numTags_, 0);
+    for(unsigned i = 0; i < words.size(); i++) {
+        ModelTagEntry * ent = new ModelTagEntry(util->mapString(words[i]));
+        ent->inDict = inDicts[i];
+        maxDict = max(maxDict, inDicts[i]);
+        ent->setNumTags(numTags_);
+        for(int j = 0; j < numTags_; j++) {
+            for(unsigned k = 0; k < numTypes[j][i]; k++, tagPos[j]++) {
+                if(tagPos[j] >= tags[j].size())
+                    THROW_ERROR("Bad number of tags in feature file "<<fileName);
+                ent->tags[j].push_back(util->mapString(tags[j][tagPos[j]]));
+                ent->tagInDicts[j].push_back(tagInDicts[j][tagPos[j]]);
+            }
+        }
+        wm_.insert(pair<KyteaString,ModelTagEntry*>(ent->word,ent));
+    }
+    for(int j = 0; j < numTags_; j++)
+        if(tagPos[j] != tags[j].size())
+            THROW_ERROR("Bad number of tags in feature file "<<fileName);
+    for(unsigned i = 0; i < 8; i++)
+        if((1 << i) & maxDict)
+            numDicts_ = i+1;
+
+    // load the features
+    vector<string> strs;
+    string str;
+    while(!in.atEnd()) {
+        // the id of the features, followed by the tags
+        in.readStrings(strs);
+        if(strs.size() == 0)
+            THROW_ERROR("Missing feature id in feature file "<<fileName);
+        istringstream titless(strs[0]);
+        titless >> str;
+        if(str == "T") {
+            titless >> str;
+            numTags_ = max(numTags_,util->parseInt(str.c_str())+1);
+        }
+        TagTriplet * trip = new TagTriplet();
+        trip->third = new KyteaModel();
+        feats_.insert(pair<KyteaString,TagTriplet*>(util->mapString(strs[0]),trip));
+        for(unsigned i = 1; i < strs.size(); i++)
+            trip->fourth.push_back(util->mapString(strs[i]));
+        // the feature names
+        in.readStrings(strs);
+        for(unsigned i = 0; i < strs.size(); i++)
+            trip->third->mapFeat(util->mapString(strs[i]));
+        // the labels, the number of features of each example, and the
+        //  features of all examples
+        uint32_t numRows = in.read<uint32_t>();
+        in.readVector(trip->second, numRows);
+        vector<uint32_t> lengths;
+        in.readVector(lengths, numRows);
+        size_t numFeats = 0;
+        for(unsigned i = 0; i < numRows; i++)
+            numFeats += lengths[i];
+        const char * ids = in.getPos();
+        in.skip(numFeats*sizeof(uint32_t));
+        trip->first.reserve(numRows, numFeats);
+        for(unsigned i = 0; i < numRows; i++) {
+            for(unsigned j = 0; j < lengths[i]; j++, ids += sizeof(uint32_t)) {
+                uint32_t id;
+                memcpy(&id, ids, sizeof(id));
+                trip->first.addFeature(id);
+            }
+            trip->first.endRow();
+        }
+    }
+}
+
+void FeatureIO::openOut(const string& fileName, bool binary) {
     if(out_) delete out_;
-    out_ = new ofstream(fileName.c_str());
+    binary_ = binary;
+    out_ = new ofstream(fileName.c_str(), (binary ? ios::out | ios::binary : ios::out));
 }
 void FeatureIO::closeOut() {
     delete out_; out_ = 0;
@@ -117,6 +300,31 @@ TagTriplet * FeatureIO::getFeatures(const KyteaString & str, bool add) {
 
 void FeatureIO::printFeatures(const KyteaString & featId, TagTriplet * trip, StringUtil * util) {    
     if(!out_ || trip->first.size() == 0) return;
+    if(binary_) {
+        vector<string> strs(1, util->showString(featId));
+        for(unsigned i = 0; i < trip->fourth.size(); i++)
+            strs.push_back(util->showString(trip->fourth[i]));
+        writeStrings(*out_, strs);
+        const FeatNameVec & names = trip->third->getOldNames();
+        strs.clear();
+        for(unsigned i = 0; i < names.size(); i++)
+            strs.push_back(util->showString(names[i]));
+        writeStrings(*out_, strs);
+        const FeatureMatrix & xs = trip->first;
+        uint32_t numRows = xs.size();
+        out_->write(reinterpret_cast<const char*>(&numRows), sizeof(numRows));
+        writeArray(*out_, trip->second);
+        vector<uint32_t> lengths(numRows), ids;
+        ids.reserve(xs.getNumFeatures());
+        for(unsigned i = 0; i < numRows; i++) {
+            lengths[i] = xs.rowSize(i);
+            for(unsigned j = 0; j < lengths[i]; j++)
+                ids.push_back(xs.row(i)[j].index);
+        }
+        writeArray(*out_, lengths);
+        writeArray(*out_, ids);
+        return;
+    }
     *out_ << util->showString(featId) << endl;
     for(unsigned i = 0; i < trip->fourth.size(); i++) {
         if(i != 0) *out_ << " ";
@@ -132,9 +340,9 @@ void FeatureIO::printFeatures(const KyteaString & featId, TagTriplet * trip, Str
     for(int i = 0; i < (int)trip->first.size(); i++) {
         // cerr << trip->second[i];
         *out_ << trip->second[i];
-        for(int j = 0; j < (int)trip->first[i].size(); j++) {
-            // cerr << " " << util->showString(names[trip->first[i][j]]) << "("<<trip->first[i][j]<<")";
-            *out_ << " " << trip->first[i][j];
+        const FeatureNode * feats = trip->first.row(i);
+        for(int j = 0; j < (int)trip->first.rowSize(i); j++) {
+            *out_ << " " << feats[j].index;
         }
         // cerr << endl;
         *out_ << endl;
@@ -158,6 +366,42 @@ void FeatureIO::printFeatures(const KyteaString & featId, StringUtil * util) {
 
 void FeatureIO::printWordMap(StringUtil * util) {
     if(!out_) return;
+    if(binary_) {
+        *out_ << FEATURE_IO_BINARY_HEADER << " " << util->getEncodingString() << "\n";
+        uint32_t numTags = numTags_;
+        out_->write(reinterpret_cast<const char*>(&numTags), sizeof(numTags));
+        vector<string> words;
+        vector<unsigned char> inDicts;
+        for(WordMap::const_iterator it = wm_.begin(); it != wm_.end(); it++) {
+            words.push_back(util->showString(it->second->word));
+            inDicts.push_back(it->second->inDict);
+        }
+        writeStrings(*out_, words);
+        writeArray(*out_, inDicts);
+        // the tags of each level, as the number of tags of each word and
+        //  the tags of all words
+        for(int i = 0; i < numTags_; i++) {
+            vector<uint32_t> numTypes;
+            vector<string> tags;
+            vector<unsigned char> tagInDicts;
+            for(WordMap::const_iterator it = wm_.begin(); it != wm_.end(); it++) {
+                const TagEntry * te = it->second;
+                if(i >= (int)te->tags.size()) {
+                    numTypes.push_back(0);
+                    continue;
+                }
+                numTypes.push_back(te->tags[i].size());
+                for(unsigned j = 0; j < te->tags[i].size(); j++) {
+                    tags.push_back(util->showString(te->tags[i][j]));
+                    tagInDicts.push_back(te->tagInDicts[i][j]);
+                }
+            }
+            writeArray(*out_, numTypes);
+            writeStrings(*out_, tags);
+            writeArray(*out_, tagInDicts);
+        }
+        return;
+    }
     *out_ << numTags_ << endl;
     *out_ << wm_.size() << endl;
     for(Dictionary<ModelTagEntry>::WordMap::const_iterator it = wm_.begin(); it != wm_.end(); it++) {
@@ -0,0 +1,119 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <kytea/feature-kernels.h>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define KYTEA_X86_KERNELS 1
+#   include <immintrin.h>
+#endif
+
+namespace kytea {
+
+static void addScalar(FeatSum * sums, const FeatVal * vals, int n) {
+    for(int i = 0; i < n; i++)
+        sums[i] += vals[i];
+}
+
+#ifdef KYTEA_X86_KERNELS
+
+#if DISABLE_QUANTIZE
+
+__attribute__((target("avx2")))
+static void addAvx2(FeatSum * sums, const FeatVal * vals, int n) {
+    int i = 0;
+    for( ; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(sums+i, _mm256_add_pd(_mm256_loadu_pd(sums+i), _mm256_loadu_pd(vals+i)));
+    for( ; i < n; i++)
+        sums[i] += vals[i];
+}
+
+__attribute__((target("sse4.1")))
+static void addSse41(FeatSum * sums, const FeatVal * vals, int n) {
+    int i = 0;
+    for( ; i + 2 <= n; i += 2)
+        _mm_storeu_pd(sums+i, _mm_add_pd(_mm_loadu_pd(sums+i), _mm_loadu_pd(vals+i)));
+    for( ; i < n; i++)
+        sums[i] += vals[i];
+}
+
+#else
+
+// Widen 16-bit values to 32-bit sums
+__attribute__((target("avx2")))
+static void addAvx2(FeatSum * sums, const FeatVal * vals, int n) {
+    int i = 0;
+    for( ; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(vals+i)));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(sums+i));
+        _mm256_storeu_si256((__m256i*)(sums+i), _mm256_add_epi32(s, v));
+    }
+    for( ; i < n; i++)
+        sums[i] += vals[i];
+}
+
+__attribute__((target("sse4.1")))
+static void addSse41(FeatSum * sums, const FeatVal * vals, int n) {
+    int i = 0;
+    for( ; i + 4 <= n; i += 4) {
+        __m128i v = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)(vals+i)));
+        __m128i s = _mm_loadu_si128((const __m128i*)(sums+i));
+        _mm_storeu_si128((__m128i*)(sums+i), _mm_add_epi32(s, v));
+    }
+    for( ; i < n; i++)
+        sums[i] += vals[i];
+}
+
+#endif
+
+#endif
+
+// Start with the plain loops, which are replaced once the processor is
+// known, so the kernels can be used at any time
+FeatKernels featKernels = { "scalar", addScalar };
+
+bool setFeatKernels(const char * name) {
+    if(!strcmp(name, "scalar")) {
+        FeatKernels kernels = { "scalar", addScalar };
+        featKernels = kernels;
+        return true;
+    }
+#ifdef KYTEA_X86_KERNELS
+    __builtin_cpu_init();
+    if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+        FeatKernels kernels = { "avx2", addAvx2 };
+        featKernels = kernels;
+        return true;
+    }
+    if(!strcmp(name, "sse4.1") && __builtin_cpu_supports("sse4.1")) {
+        FeatKernels kernels = { "sse4.1", addSse41 };
+        featKernels = kernels;
+        return true;
+    }
+#endif
+    return false;
+}
+
+// Choose the best kernels when the library is loaded
+static struct FeatKernelChooser {
+    FeatKernelChooser() {
+        if(!setFeatKernels("avx2") && !setFeatKernels("sse4.1"))
+            setFeatKernels("scalar");
+    }
+} featKernelChooser;
+
+}
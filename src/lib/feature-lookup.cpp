@@ -2,6 +2,8 @@
 #include <kytea/feature-lookup.h>
 #include <kytea/kytea-util.h>
 #include <kytea/dictionary.h>
+#include <kytea/analysis-scratch.h>
+#include <kytea/feature-kernels.h>
 #include <algorithm>
 
 using namespace kytea;
@@ -22,22 +24,34 @@ void FeatureLookup::addNgramScores(const Dictionary<FeatVec> * dict,
                                    int window, 
                                    vector<FeatSum> & score) {
     if(!dict) return;
-    Dictionary<FeatVec>::MatchResult res = dict->match(str);
     // For every entry
-    for(int i = 0; i < (int)res.size(); i++) {
+    dict->visitMatches(str, [&](unsigned matchEnd, unsigned id) {
         // Let's say we have a n-gram that matched at position 2
         // The first boundary that can be affected is 2-window
-        const int base_pos = res[i].first - window;
+        const int base_pos = (int)matchEnd - window;
         const int start = max(0, -base_pos);
         const int end = min(window*2,(int)score.size()-base_pos);
-        const FeatVec & vec = *res[i].second;
-        for(int j = start; j < end; j++) {
-            // cerr << "adding score[" << base_pos+j << "] += vec["<<j<<"] "<<vec[j]<<endl;
-            score[base_pos+j] += vec[j];
-        }
-    }
+        const FeatVal * vec = dict->getValues(id);
+        if(start < end)
+            addFeatVals(&score[base_pos+start], vec+start, end-start);
+    });
 }
 
+// Two pieces of a string that are viewed as if they were joined together,
+// so they can be matched without making a new string
+class JoinedString {
+public:
+    JoinedString(const KyteaString & str, int firstStart, int firstLen, int secondStart, int secondLen) :
+        str_(str), firstStart_(firstStart), firstLen_(firstLen), secondStart_(secondStart), secondLen_(secondLen) { }
+    unsigned length() const { return firstLen_ + secondLen_; }
+    KyteaChar operator[](int i) const {
+        return (i < firstLen_ ? str_[firstStart_+i] : str_[secondStart_+i-firstLen_]);
+    }
+private:
+    const KyteaString & str_;
+    int firstStart_, firstLen_, secondStart_, secondLen_;
+};
+
 // Look up values 
 void FeatureLookup::addTagNgrams(const KyteaString & chars, 
                                  const Dictionary<FeatVec> * dict, 
@@ -49,103 +63,110 @@ void FeatureLookup::addTagNgrams(const KyteaString & chars,
     int myStart = max(startChar-window,0);
     int myEnd = min(endChar+window,(int)chars.length());
     // cerr << "startChar=="<<startChar<<", endChar=="<<endChar<<", myStart=="<<myStart<<", myEnd=="<<myEnd<<endl;
-    KyteaString str = 
-        chars.substr(myStart, startChar-myStart) +
-        chars.substr(endChar, myEnd-endChar);
-    // Match the features in this substring
-    Dictionary<FeatVec>::MatchResult res = dict->match(str);
-    // Add up the sum of all the features
+    JoinedString str(chars, myStart, startChar-myStart, endChar, myEnd-endChar);
+    // Match the features in this substring, and add up the sum of all the
+    // features
     // myStart-startChar is how far to the left of the starting character we are
     int offset = window-(startChar-myStart);
-    for(int i = 0; i < (int)res.size(); i++) {
+    dict->visitMatches(str, [&](unsigned matchEnd, unsigned id) {
         // The position we are interested in is the matched position plus the
         // offset
-        int pos = res[i].first + offset;
+        int pos = matchEnd + offset;
         // Reverse this and multiply by the number of candidates
         pos = (window*2 - pos - 1) * scores.size();
-        FeatVal* vec = &((*res[i].second)[pos]);
-        // Now add up all the values in the feature vector
-        for(int j = 0; j < (int)scores.size(); j++) {
+        const FeatVal* vec = dict->getValues(id) + pos;
 #ifdef KYTEA_SAFE
-            if(j+pos >= (int)res[i].second->size() || j+pos < 0)
-                THROW_ERROR("j+pos "<<j<<"+"<<pos<<" too big for res[i].second->size() "<<res[i].second->size()<<", window="<<window);
+        if(pos < 0 || pos + scores.size() > dict->getNumValues(id))
+            THROW_ERROR("pos "<<pos<<"+"<<scores.size()<<" too big for getNumValues() "<<dict->getNumValues(id)<<", window="<<window);
 #endif
-            scores[j] += vec[j];
-        }
-    }
+        // Now add up all the values in the feature vector
+        addFeatVals(scores.data(), vec, scores.size());
+    });
 }
 
 // Add weights corresponding to the "self" features
 // word is the word we are interested in looking up, scores is the output,
 // and featIdx is the index of the features
-void FeatureLookup::addSelfWeights(const KyteaString & word, 
+void FeatureLookup::addSelfWeights(const KyteaStringView & word, 
                                    vector<FeatSum> & scores,
                                    int featIdx) {
 #ifdef KYTEA_SAFE
     if(selfDict_ == NULL) THROW_ERROR("Trying to add self weights when no self is present");
 #endif
-    FeatVec * entry = selfDict_->findEntry(word);
-    if(entry) {
-        int base = featIdx * scores.size();
-        for(int i = 0; i < (int)scores.size(); i++)
-            scores[i] += (*entry)[base+i];
+    int id = selfDict_->findEntryId(word);
+    if(id >= 0) {
+        const FeatVal * entry = selfDict_->getValues(id) + featIdx * scores.size();
+        addFeatVals(scores.data(), entry, scores.size());
     }
 }
 
-void FeatureLookup::addDictionaryScores(const Dictionary<ModelTagEntry>::MatchResult & matches, int numDicts, int max, vector<FeatSum> & score) {
-    if(dictVector_ == NULL || dictVector_->size() == 0 || matches.size() == 0) return;
-    const int len = score.size(), dictLen = len*3*max;
-    vector<char> on(numDicts*dictLen, 0);
-    int end;
-    ModelTagEntry* myEntry;
-    for(int i = 0; i < (int)matches.size(); i++) {
-        end = matches[i].first;
-        myEntry = matches[i].second;
-        if(myEntry->inDict == 0)
-            continue;
-        const int wlen = myEntry->word.length();
-        const int lablen = min(wlen,max)-1;
-        for(int di = 0; ((1 << di) & ~1) <= myEntry->inDict; di++) {
-            if(myEntry->isInDict(di)) {
-                const int dictOffset = di*dictLen;
-                // left value (position end-wlen, type
-                if(end >= wlen)
-                    on[dictOffset + (end-wlen)*3*max +lablen*3 /*+ 0*/] = 1;
-                // middle values
-                for(int k = end-wlen+1; k < end; k++)
-                    on[dictOffset +     k*3*max      +lablen*3 + 1    ] = 1;
-                // right value
-                if(end != len)
-                    on[dictOffset +     end*3*max    +lablen*3 + 2    ] = 1;
-            }
-        }
-    }
-    for(int i = 0; i < len; i++) {
-        FeatSum & val = score[i];
-        for(int di = 0; di < numDicts; di++) {
-            char* myOn = &on[di*dictLen + i*3*max];
-            FeatVal* myScore = &(*dictVector_)[3*max*di];
-            for(int j = 0; j < 3*max; j++) {
-                // cerr << "i="<<i<<", di="<<di<<", j/3="<<j/3<<", j%3="<<j%3<<", myOn="<<(int)myOn[j]<<", myScore="<<myScore[j]<<endl;
-                val += myOn[j]*myScore[j];
-            }
+// Add the dictionary features that are active because entry ends at the
+// boundary end. Each feature is numbered in the order (boundary, dictionary,
+// length, type), so sorted features are added in the same order as the loops
+// over all features that this replaces.
+inline void markDictionaryFeatures(const ModelTagEntry * myEntry, int end, int len, int numDicts, int max, vector<unsigned> & feats) {
+    if(myEntry->inDict == 0)
+        return;
+    const int posLen = numDicts*3*max;
+    const int wlen = myEntry->word.length();
+    const int lablen = min(wlen,max)-1;
+    for(int di = 0; ((1 << di) & ~1) <= myEntry->inDict; di++) {
+        if(myEntry->isInDict(di)) {
+            const int dictOffset = di*3*max + lablen*3;
+            // left value (position end-wlen, type
+            if(end >= wlen)
+                feats.push_back((end-wlen)*posLen + dictOffset /*+ 0*/);
+            // middle values
+            for(int k = end-wlen+1; k < end; k++)
+                feats.push_back(       k*posLen + dictOffset + 1    );
+            // right value
+            if(end != len)
+                feats.push_back(     end*posLen + dictOffset + 2    );
         }
     }
 }
 
+void FeatureLookup::addActiveDictionaryScores(vector<unsigned> & feats, int numDicts, int max, vector<FeatSum> & score) {
+    // A feature that is activated by several matches is only counted once
+    sort(feats.begin(), feats.end());
+    feats.erase(unique(feats.begin(), feats.end()), feats.end());
+    const unsigned posLen = numDicts*3*max;
+    const FeatVal * weights = dictVector_->data();
+    for(unsigned i = 0; i < feats.size(); i++)
+        score[feats[i] / posLen] += weights[feats[i] % posLen];
+}
+
+void FeatureLookup::addDictionaryScores(const Dictionary<ModelTagEntry>::MatchResult & matches, int numDicts, int max, vector<FeatSum> & score) {
+    if(dictVector_ == NULL || dictVector_->size() == 0 || matches.size() == 0) return;
+    const int len = score.size();
+    vector<unsigned> feats;
+    for(int i = 0; i < (int)matches.size(); i++)
+        markDictionaryFeatures(matches[i].second, matches[i].first, len, numDicts, max, feats);
+    addActiveDictionaryScores(feats, numDicts, max, score);
+}
+
+void FeatureLookup::addDictionaryScores(const Dictionary<ModelTagEntry> * dict, const KyteaString & chars, int numDicts, int max, vector<FeatSum> & score) {
+    if(dictVector_ == NULL || dictVector_->size() == 0 || dict == NULL) return;
+    const int len = score.size();
+    vector<unsigned> & feats = AnalysisScratch::get().dictFeats;
+    feats.clear();
+    dict->visitMatches(chars, [&](unsigned end, unsigned id) {
+        markDictionaryFeatures(dict->getEntry(id), end, len, numDicts, max, feats);
+    });
+    addActiveDictionaryScores(feats, numDicts, max, score);
+}
+
 void FeatureLookup::addTagDictWeights(const std::vector<pair<int,int> > & exists, 
                                       std::vector<FeatSum> & scores) {
     if(!exists.size()) {
         if(tagUnkVector_)
-            for(int i = 0; i < (int)scores.size(); i++)
-                scores[i] += (*tagUnkVector_)[i];
+            addFeatVals(scores.data(), tagUnkVector_->data(), scores.size());
     } else {
         if(tagDictVector_) {
             int tags = scores.size();
             for(int j = 0; j < (int)exists.size(); j++) {
                 int base = exists[j].first*tags*tags+exists[j].second*tags;
-                for(int i = 0; i < (int)scores.size(); i++)
-                    scores[i] += (*tagDictVector_)[base+i];
+                addFeatVals(scores.data(), &(*tagDictVector_)[base], tags);
             }
         }
     }
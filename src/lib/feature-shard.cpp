@@ -0,0 +1,122 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <kytea/feature-shard.h>
+#include <kytea/kytea-util.h>
+#include <cstdio>
+
+using namespace kytea;
+using namespace std;
+
+// Each example is written as the id of its classifier, its label, the
+// number of features, and the features, all as 32-bit integers
+
+FeatureShard::FeatureShard(const string & fileName) : fileName_(fileName), out_(0) {
+    if(fileName_.length() == 0)
+        return;
+    out_ = new ofstream(fileName_.c_str(), ios::out | ios::binary | ios::trunc);
+    if(out_->fail()) {
+        delete out_;
+        THROW_ERROR("Could not open temporary feature file "<<fileName_<<" for writing");
+    }
+}
+
+FeatureShard::~FeatureShard() {
+    if(out_) delete out_;
+    if(fileName_.length())
+        remove(fileName_.c_str());
+}
+
+unsigned FeatureShard::getId(TagTriplet * trip) {
+    unordered_map<TagTriplet*, unsigned>::const_iterator it = ids_.find(trip);
+    if(it != ids_.end())
+        return it->second;
+    unsigned id = trips_.size();
+    ids_.insert(pair<TagTriplet*, unsigned>(trip, id));
+    trips_.push_back(trip);
+    rows_.push_back(0);
+    feats_.push_back(0);
+    return id;
+}
+
+void FeatureShard::write(unsigned id, int label) {
+    buff_[0] = id;
+    buff_[1] = (unsigned)label;
+    buff_[2] = buff_.size()-3;
+    out_->write(reinterpret_cast<const char*>(&buff_[0]), buff_.size()*sizeof(unsigned));
+    rows_[id]++;
+    feats_[id] += buff_.size()-3;
+}
+
+void FeatureShard::add(TagTriplet * trip, const vector<unsigned> & feats, int label) {
+    if(!out_) {
+        trip->first.push_back(feats);
+        trip->second.push_back(label);
+        return;
+    }
+    buff_.resize(3);
+    buff_.insert(buff_.end(), feats.begin(), feats.end());
+    write(getId(trip), label);
+}
+
+void FeatureShard::add(TagTriplet * trip, const FeatureMatrix & xs, const vector<int> & ys) {
+    if(!out_) {
+        trip->first.append(xs);
+        trip->second.insert(trip->second.end(), ys.begin(), ys.end());
+        return;
+    }
+    unsigned id = getId(trip);
+    for(unsigned i = 0; i < xs.size(); i++) {
+        buff_.resize(3);
+        const FeatureNode * row = xs.row(i);
+        for(unsigned j = 0; j < xs.rowSize(i); j++)
+            buff_.push_back(row[j].index);
+        write(id, ys[i]);
+    }
+}
+
+void FeatureShard::load() {
+    if(!out_)
+        return;
+    out_->close();
+    bool failed = out_->fail();
+    delete out_;
+    out_ = 0;
+    if(failed)
+        THROW_ERROR("Failed to write temporary feature file "<<fileName_);
+    // allocate the matrices at their final size
+    for(unsigned i = 0; i < trips_.size(); i++) {
+        FeatureMatrix & xs = trips_[i]->first;
+        xs.reserve(xs.size()+rows_[i], xs.getNumFeatures()+feats_[i]);
+        trips_[i]->second.reserve(trips_[i]->second.size()+rows_[i]);
+    }
+    ifstream in(fileName_.c_str(), ios::in | ios::binary);
+    if(in.fail())
+        THROW_ERROR("Could not open temporary feature file "<<fileName_<<" for reading");
+    unsigned head[3];
+    while(in.read(reinterpret_cast<char*>(head), sizeof(head))) {
+        if(head[0] >= trips_.size())
+            THROW_ERROR("Bad classifier id in temporary feature file "<<fileName_);
+        buff_.resize(head[2]);
+        if(head[2] > 0 && !in.read(reinterpret_cast<char*>(&buff_[0]), head[2]*sizeof(unsigned)))
+            THROW_ERROR("Temporary feature file "<<fileName_<<" is truncated");
+        trips_[head[0]]->first.push_back(buff_);
+        trips_[head[0]]->second.push_back((int)head[1]);
+    }
+    if(!in.eof() || in.gcount() != 0)
+        THROW_ERROR("Temporary feature file "<<fileName_<<" is truncated");
+    vector<unsigned>().swap(buff_);
+}
@@ -2,7 +2,20 @@
 #include <kytea/kytea-util.h>
 #include <kytea/kytea-string.h>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
 #include <stdint.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define fstat _fstat
+#define stat _stat
+#define S_ISREG(m) (((m) & _S_IFMT) == _S_IFREG)
+#else
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace kytea;
@@ -62,3 +75,80 @@ KyteaString GeneralIO::readKyteaString() {
         ret[i] = readBinary<KyteaChar>();
     return ret;
 }
+
+FileDescriptorBuf::int_type FileDescriptorBuf::underflow() {
+    if(gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+    // read() returns what is available without waiting for a full block
+    long got;
+    do {
+        got = read(fd_, &buff_[0], buff_.size());
+    } while(got < 0 && errno == EINTR);
+    if(got <= 0)
+        return traits_type::eof();
+    setg(&buff_[0], &buff_[0], &buff_[0] + got);
+    return traits_type::to_int_type(*gptr());
+}
+
+bool FileDescriptorBuf::isRegularFile() const {
+    struct stat st;
+    return fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool LineReader::readLine(const char *& line, size_t & len) {
+    // the number of bytes after start_ that have no newline
+    size_t searched = 0;
+    while(true) {
+        const char * begin = (buff_.size() ? &buff_[0] : 0) + start_;
+        const char * nl = 0;
+        if(end_ - start_ > searched)
+            nl = (const char*)memchr(begin+searched, '\n', end_-start_-searched);
+        if(nl != 0) {
+            line = begin;
+            len = nl - begin;
+            start_ += len + 1;
+            return true;
+        }
+        searched = end_ - start_;
+        if(!fill()) {
+            line = (buff_.size() ? &buff_[0] : 0) + start_;
+            len = end_ - start_;
+            start_ = end_;
+            return false;
+        }
+    }
+}
+
+bool LineReader::fill() {
+    if(eof_)
+        return false;
+    if(start_ > 0) {
+        memmove(&buff_[0], &buff_[start_], end_-start_);
+        end_ -= start_;
+        start_ = 0;
+    }
+    if(end_ == buff_.size())
+        buff_.resize(max(buff_.size()*2, (size_t)BLOCK_SIZE));
+    streambuf * buf = str_->rdbuf();
+    streamsize space = buff_.size() - end_;
+    streamsize avail = buf->in_avail();
+    if(avail > 0) {
+        end_ += buf->sgetn(&buff_[end_], min(avail, space));
+        return true;
+    }
+    // nothing is buffered, so take characters until more are available
+    // or the line ends, which waits no longer than getline() would
+    bool got = false;
+    int c;
+    while(end_ < buff_.size() && (c = buf->sbumpc()) != char_traits<char>::eof()) {
+        buff_[end_++] = (char)c;
+        got = true;
+        if(c == '\n' || buf->in_avail() > 0)
+            break;
+    }
+    if(!got) {
+        eof_ = true;
+        str_->setstate(ios::eofbit);
+    }
+    return got;
+}
@@ -85,7 +85,12 @@ void KyteaConfig::printUsage() {
 "  -subword A file of subword units. This will enable unknown word PE." << endl <<
 "  -model   The file to write the trained model to" << endl <<
 "  -modtext Print a text model (instead of the default binary)" << endl <<
+"  -modmap  Print a binary model whose dictionary automata and feature values" << endl <<
+"           are memory-mapped (tag entries and LMs are still read into memory)" << endl <<
 "  -featout Write the features used in training the model to this file" << endl <<
+"  -featbin Write the -featout features in a binary format (loads faster)" << endl <<
+"  -stream  Read the corpora again in each pass of training instead of keeping"<<endl<<
+"           them in memory, writing temporary feature files to this directory" << endl <<
 "Model Training Options (basic)" << endl <<
 "  -nows    Don't train a word segmentation model" << endl <<
 "  -notags  Skip the training of tagging, do only word segmentation" << endl <<
@@ -103,6 +108,13 @@ void KyteaConfig::printUsage() {
 "  -nobias  Don't use a bias value in classifier training" << endl <<
 "  -solver  The solver (1=SVM, 7=logistic regression, etc.; default 1,"<<endl<<
 "           see LIBLINEAR documentation for more details)" << endl <<
+"  -threads The number of threads to use for classifier training (default 1)" << endl <<
+"Hyperparameter Sweep Options (for advanced users): " << endl <<
+"  -sweepcost   Train with each of these costs (separated by commas)" << endl <<
+"  -sweepsolver Train with each of these solvers (separated by commas)" << endl <<
+"  -heldout     A fully annotated corpus that the models trained with each" << endl <<
+"               cost and solver are tested on. The most accurate is written" << endl <<
+"               to -model" << endl <<
 "Format Options (for advanced users): " << endl <<
 "  -wordbound The separator for words in full annotation (\" \")" << endl <<
 "  -tagbound  The separator for tags in full/partial annotation (\"/\")" << endl <<
@@ -127,6 +139,9 @@ void KyteaConfig::printUsage() {
 "  -wsconst Specifies character types to not be segmented (e.g. D for digits)" << endl <<
 "  -unkbeam The width of the beam to use in beam search for unknown words " << endl <<
 "           (default 50, 0 for full search)" << endl <<
+"  -unkcache The number of unknown words whose tags are cached (default 0," << endl <<
+"           no cache)" << endl <<
+"  -threads The number of threads to use for analysis (default 1)" << endl <<
 "  -debug   The debugging level (0=silent, 1=simple, 2=detailed)" << endl <<
 "Format Options: " << endl <<
 "  -in      The formatting of the input  (raw/tok/full/part/conf, default raw)" << endl <<
@@ -184,14 +199,36 @@ unsigned KyteaConfig::parseTrainArg(const char * n, const char * v) {
     // output option for training
     else if(!strcmp(n, "-model"))    { ch(n,v); setModelFile(v); }
     else if(!strcmp(n, "-modtext"))  { setModelFormat('T'); r=0; }
+    else if(!strcmp(n, "-modmap"))   { setModelFormat('M'); r=0; }
     else if(!strcmp(n, "-featout"))  { ch(n,v); setFeatureOut(v); }
+    else if(!strcmp(n, "-featbin"))  { setFeatureBinary(true); r=0; }
     else if(!strcmp(n, "-feat"))     { ch(n,v); setFeatureIn(v); }
+    else if(!strcmp(n, "-stream"))   { ch(n,v); setStreamDir(v); }
     else if(!strcmp(n, "-numtags"))  { ch(n,v); setNumTags(util_->parseInt(v)); }
 
     // liblinear options
     else if(!strcmp(n, "-eps"))      { ch(n,v); setEpsilon(util_->parseFloat(v)); }
     else if(!strcmp(n, "-cost"))      { ch(n,v); setCost(util_->parseFloat(v)); }
     else if(!strcmp(n, "-solver"))   { ch(n,v); setSolverType(util_->parseInt(v)); }
+    else if(!strcmp(n, "-threads"))  { 
+        ch(n,v); 
+        if(util_->parseInt(v) < 1) THROW_ERROR("Illegal setting "<<v<<" for -threads (must be 1 or greater)");
+        setNumThreads(util_->parseInt(v));
+    }
+
+    // hyperparameter sweep options
+    else if(!strcmp(n, "-sweepcost") || !strcmp(n, "-sweepsolver")) {
+        ch(n,v);
+        istringstream iss(v);
+        string val;
+        while(getline(iss, val, ',')) {
+            if(!strcmp(n, "-sweepcost"))
+                addSweepCost(util_->parseFloat(val.c_str()));
+            else
+                addSweepSolver(util_->parseInt(val.c_str()));
+        }
+    }
+    else if(!strcmp(n, "-heldout"))  { ch(n,v); setHeldOut(v); }
 
     // feature options
     else if(!strcmp(n, "-charw"))    { ch(n,v); setCharWindow(util_->parseInt(v)); }
@@ -260,6 +297,16 @@ unsigned KyteaConfig::parseRunArg(const char * n, const char * v) {
     else if(!strcmp(n, "-deftag"))   { ch(n,v); setDefaultTag(v); }
     else if(!strcmp(n, "-unkbeam"))  { ch(n,v); setUnkBeam(util_->parseInt(v)); }
     else if(!strcmp(n, "-debug"))    { ch(n,v); setDebug(util_->parseInt(v)); }
+    else if(!strcmp(n, "-threads"))  { 
+        ch(n,v); 
+        if(util_->parseInt(v) < 1) THROW_ERROR("Illegal setting "<<v<<" for -threads (must be 1 or greater)");
+        setNumThreads(util_->parseInt(v));
+    }
+    else if(!strcmp(n, "-unkcache")) { 
+        ch(n,v); 
+        if(util_->parseInt(v) < 0) THROW_ERROR("Illegal setting "<<v<<" for -unkcache (must be 0 or greater)");
+        setUnkCacheSize(util_->parseInt(v));
+    }
 
     // formatting options
     else if(!strcmp(n, "-wordbound"))     { ch(n,v); setWordBound(v); }
@@ -293,7 +340,7 @@ void KyteaConfig::setEncoding(const char* str) {
 
 KyteaConfig::KyteaConfig() : onTraining_(true), debug_(0), util_(0), dicts_(), 
                 modelForm_('B'), inputForm_(CORP_FORMAT_DEFAULT),
-                outputForm_(CORP_FORMAT_FULL), featStr_(0),
+                outputForm_(CORP_FORMAT_FULL), featStr_(0), featBin_(false),
                 doWS_(true), doTags_(true), doUnk_(true),
                 addFeat_(false), confidence_(0.0), charW_(3), charN_(3), 
                 typeW_(3), typeN_(3), dictN_(4), 
@@ -303,7 +350,7 @@ KyteaConfig::KyteaConfig() : onTraining_(true), debug_(0), util_(0), dicts_(),
                 wordBound_(" "), tagBound_("/"), elemBound_("&"), unkBound_(" "), 
                 noBound_("-"), hasBound_("|"), skipBound_("?"), escape_("\\"), 
                 wsConstraint_(""),
-                numTags_(0), tagMax_(3) {
+                numTags_(0), tagMax_(3), numThreads_(1), unkCacheSize_(0) {
     setEncoding("utf8");
 }
 KyteaConfig::KyteaConfig(const KyteaConfig & rhs) 
@@ -311,6 +358,8 @@ KyteaConfig::KyteaConfig(const KyteaConfig & rhs)
                  util_(rhs.util_), dicts_(rhs.dicts_),
                  modelForm_(rhs.modelForm_), inputForm_(rhs.inputForm_), 
                  outputForm_(rhs.outputForm_), featStr_(rhs.featStr_), 
+                 featBin_(rhs.featBin_),
+                 streamDir_(rhs.streamDir_),
                  doWS_(rhs.doWS_), doTags_(rhs.doTags_), 
                  doUnk_(rhs.doUnk_), addFeat_(rhs.addFeat_), 
                  confidence_(rhs.confidence_), charW_(rhs.charW_), 
@@ -319,11 +368,14 @@ KyteaConfig::KyteaConfig(const KyteaConfig & rhs)
                  unkN_(rhs.unkN_), unkBeam_(rhs.unkBeam_), 
                  defTag_(rhs.defTag_), unkTag_(rhs.unkTag_), 
                  bias_(rhs.bias_), eps_(rhs.eps_), cost_(rhs.cost_), 
-                 solverType_(rhs.solverType_), wordBound_(rhs.wordBound_), 
+                 solverType_(rhs.solverType_), sweepCosts_(rhs.sweepCosts_),
+                 sweepSolvers_(rhs.sweepSolvers_), heldOut_(rhs.heldOut_),
+                 wordBound_(rhs.wordBound_), 
                  tagBound_(rhs.tagBound_), elemBound_(rhs.elemBound_), 
                  unkBound_(rhs.unkBound_), noBound_(rhs.noBound_), 
                  hasBound_(rhs.hasBound_), skipBound_(rhs.skipBound_), 
-                 escape_(rhs.escape_), numTags_(rhs.numTags_), tagMax_(rhs.tagMax_)
+                 escape_(rhs.escape_), numTags_(rhs.numTags_), tagMax_(rhs.tagMax_),
+                 numThreads_(rhs.numThreads_), unkCacheSize_(rhs.unkCacheSize_)
 {
 
 }
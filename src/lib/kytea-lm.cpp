@@ -70,9 +70,86 @@ void KyteaLM::train(const std::vector<KyteaString> & corpus) {
     // calculate the fallbacks
     for(KyteaDoubleMap::iterator it = fallbacks_.begin(); it != fallbacks_.end(); it++)
         it->second = log((it->second*discounts[it->first.length()])/denominators[it->first]);
+    buildPackedTables();
 }
 
-double KyteaLM::scoreSingle(const KyteaString & val, int pos) {
+void PackedNgramTable::build(const KyteaDoubleMap & map, unsigned len) {
+    unsigned size = 0;
+    for(KyteaDoubleMap::const_iterator it = map.begin(); it != map.end(); it++)
+        if(it->first.length() == len)
+            size++;
+    // keep the table at most half full
+    unsigned capacity = 1;
+    while(capacity < size*2)
+        capacity *= 2;
+    uint64_t empty = EMPTY_KEY;
+    keys_.assign(capacity, empty);
+    vals_.assign(capacity, 0);
+    mask_ = capacity-1;
+    hasEmptyKey_ = false;
+    for(KyteaDoubleMap::const_iterator it = map.begin(); it != map.end(); it++) {
+        if(it->first.length() != len)
+            continue;
+        uint64_t key = 0;
+        for(unsigned i = 0; i < len; i++)
+            key = (key << 16) | it->first[i];
+        if(key == EMPTY_KEY) {
+            hasEmptyKey_ = true;
+            emptyKeyVal_ = it->second;
+            continue;
+        }
+        uint64_t i = hash(key) & mask_;
+        while(keys_[i] != EMPTY_KEY)
+            i = (i+1) & mask_;
+        keys_[i] = key;
+        vals_[i] = it->second;
+    }
+}
+
+void KyteaLM::buildPackedTables() {
+    packedProbs_.clear();
+    packedFallbacks_.clear();
+    if(n_ == 0 || n_ > MAX_PACKED_N)
+        return;
+    packedProbs_.resize(n_+1);
+    packedFallbacks_.resize(n_);
+    for(unsigned i = 1; i <= n_; i++)
+        packedProbs_[i].build(probs_, i);
+    for(unsigned i = 0; i < n_; i++)
+        packedFallbacks_[i].build(fallbacks_, i);
+}
+
+// the lowest len characters of a key
+static inline uint64_t lowChars(uint64_t key, unsigned len) {
+    return (len >= 4 ? key : key & ((1ULL << (16*len))-1));
+}
+
+double KyteaLM::scorePacked(uint64_t key) const {
+    double prob = 0, val;
+    for(unsigned len = n_; len > 0; len--) {
+        if(packedProbs_[len].find(lowChars(key, len), val))
+            return prob + val;
+        if(packedFallbacks_[len-1].find(lowChars(key >> 16, len-1), val))
+            prob += val;
+    }
+    return prob + log(1.0/vocabSize_);
+}
+
+double KyteaLM::scoreNext(KyteaLMState & state, KyteaChar next) const {
+    uint64_t key = (state << 16) | next;
+    state = lowChars(key, n_-1);
+    return scorePacked(key);
+}
+
+double KyteaLM::scoreSingle(const KyteaString & val, int pos) const {
+    if(isPacked()) {
+        // the n-gram ends with 0 after the end of the string
+        uint64_t key = 0;
+        int start = max(pos-(int)n_+1, 0);
+        for(int i = start; i <= pos; i++)
+            key = (key << 16) | (i < (int)val.length() ? val[i] : 0);
+        return scorePacked(key);
+    }
     KyteaString ngram(n_);
     for(unsigned i = 0; i < n_; i++) ngram[i] = 0;
     int npos = n_;
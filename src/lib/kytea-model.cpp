@@ -8,6 +8,7 @@
 #include <cmath>
 #include <algorithm>
 #include <iostream>
+#include <cstddef>
 
 using namespace kytea;
 using namespace std;
@@ -144,23 +145,15 @@ void KyteaModel::printClassifier(const vector<unsigned> & feat, StringUtil * uti
     
 }
 
-// allocate a LL feature node
-feature_node * allocateFeatures(const vector<unsigned> & feats, int biasId, double biasVal) {
-    feature_node * nodes = (feature_node*)malloc((feats.size()+(biasVal>=0?2:1))*sizeof(feature_node));
-    unsigned i;
-    for(i = 0; i < feats.size(); i++) {
-        nodes[i].index=feats[i];
-        nodes[i].value = 1;
-    }
-    if(biasVal >= 0) {
-        nodes[i].index = biasId;
-        nodes[i++].value = biasVal;
-    }
-    nodes[i].index = -1;
-    return nodes;
-}
+// The examples are given to liblinear in place, so the nodes must be laid out
+// in the same way
+static_assert(sizeof(FeatureNode) == sizeof(feature_node)
+              && offsetof(FeatureNode, index) == offsetof(feature_node, index)
+              && offsetof(FeatureNode, value) == offsetof(feature_node, value),
+              "FeatureNode must have the same layout as feature_node");
+
 // train the model
-void KyteaModel::trainModel(const vector< vector<unsigned> > & xs, vector<int> & ys, double bias, int solver, double epsilon, double cost) {
+void KyteaModel::trainModel(FeatureMatrix & xs, vector<int> & ys, double bias, int solver, double epsilon, double cost, int numThreads) {
     if(xs.size() == 0) return;
     solver_ = solver;
     if(weights_.size()>0)
@@ -179,11 +172,11 @@ void KyteaModel::trainModel(const vector< vector<unsigned> > & xs, vector<int> &
     // }
     prob.y = &ys.front();
 
-    // allocate the feature space
+    // point at the examples, which are used without copying them
+    xs.setBias(getBiasId(), bias);
     feature_node** myXs = (feature_node**)malloc(sizeof(feature_node*)*xs.size());
-    int biasId = getBiasId();
     for(int i = 0; i < prob.l; i++)
-        myXs[i] = allocateFeatures(xs[i], biasId, bias);
+        myXs[i] = reinterpret_cast<feature_node*>(xs.row(i));
     prob.x = myXs;
 
     prob.bias = bias;
@@ -195,6 +188,7 @@ void KyteaModel::trainModel(const vector< vector<unsigned> > & xs, vector<int> &
     param.nr_weight = 0;
     param.weight_label = NULL;
     param.weight = NULL;
+    param.nr_thread = numThreads;
     if(param.eps == HUGE_VAL) {
     	if(param.solver_type == L2R_LR || param.solver_type == L2R_L2LOSS_SVC)
     		param.eps = 0.01;
@@ -206,8 +200,6 @@ void KyteaModel::trainModel(const vector< vector<unsigned> > & xs, vector<int> &
     model* mod_ = train(&prob, &param);
 
     // free the problem
-    for(int i = 0; i < prob.l; i++)
-        free(myXs[i]);
     free(myXs);
 
     int i, j;
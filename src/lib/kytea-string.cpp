@@ -4,13 +4,19 @@
 using namespace kytea;
 using namespace std;
 
-// Constructors for KyteaStringImpl
-KyteaStringImpl::KyteaStringImpl(unsigned length) : length_(length), count_(1) {
-    chars_ = new KyteaChar[length];
+// Allocate the header and the characters of an implementation at once
+KyteaStringImpl * KyteaStringImpl::create(unsigned length) {
+    size_t size = offsetof(KyteaStringImpl, chars_) + sizeof(KyteaChar)*length;
+    return new(::operator new(size)) KyteaStringImpl(length);
 }
-KyteaStringImpl::KyteaStringImpl(const KyteaStringImpl & impl) : length_(impl.length_), count_(1) {
-    chars_ = new KyteaChar[length_];
-    memcpy(chars_, impl.chars_, sizeof(KyteaChar)*length_);
+KyteaStringImpl * KyteaStringImpl::create(const KyteaStringImpl & impl) {
+    KyteaStringImpl * ret = create(impl.length_);
+    memcpy(ret->chars_, impl.chars_, sizeof(KyteaChar)*impl.length_);
+    return ret;
+}
+void KyteaStringImpl::destroy(KyteaStringImpl * impl) {
+    impl->~KyteaStringImpl();
+    ::operator delete(impl);
 }
 
 // tokenize the string using the characters in the delimiter string
@@ -19,7 +25,7 @@ KyteaString::Tokens KyteaString::tokenize(const KyteaString & delim, bool includ
     const unsigned l=length(),dl=delim.length();
     vector<KyteaString> ret;
     for(i = 0; i < l; i++) {
-        for(j = 0; j < dl && delim[j] != impl_->chars_[i]; j++);
+        for(j = 0; j < dl && delim[j] != (*this)[i]; j++);
         if(j != dl) {
             if(s != i)
                 ret.push_back(substr(s,i-s));
@@ -42,7 +48,7 @@ void KyteaString::splice(const KyteaString& str, unsigned pos) {
     if(pos+l > length())
         throw runtime_error("KyteaString splice index out of bounds");
 #endif
-    memcpy(impl_->chars_+pos, str.getImpl()->chars_, sizeof(KyteaChar)*l);
+    memcpy(getWritableChars()+pos, str.getChars(), sizeof(KyteaChar)*l);
 }
 
 KyteaString KyteaString::substr(unsigned s) const {
@@ -52,7 +58,7 @@ KyteaString KyteaString::substr(unsigned s) const {
         throw runtime_error("KyteaString substr index out of bounds");
 #endif
     KyteaString ret(l);
-    memcpy(ret.getImpl()->chars_, impl_->chars_+s, sizeof(KyteaChar)*l);
+    memcpy(ret.getWritableChars(), getChars()+s, sizeof(KyteaChar)*l);
     return ret;
 }
 
@@ -63,27 +69,28 @@ KyteaString KyteaString::substr(unsigned s, unsigned l) const {
         throw runtime_error("substr out of bounds");
 #endif
     KyteaString ret(l);
-    memcpy(ret.getImpl()->chars_, impl_->chars_+s, sizeof(KyteaChar)*l);
+    memcpy(ret.getWritableChars(), getChars()+s, sizeof(KyteaChar)*l);
     return ret;
 }
 
 size_t KyteaString::getHash() const {
     size_t hash = 5381;
-    if(impl_==0)
-        return hash;
-    const unsigned l = impl_->length_;
-    const KyteaChar* cs = impl_->chars_;
+    const unsigned l = length_;
+    const KyteaChar* cs = getChars();
     for(unsigned i = 0; i < l; i++)
         hash = ((hash << 5) + hash) + cs[i]; /* hash * 33 + x[i] */
     return hash;
 }
 
-KyteaStringImpl * KyteaString::getImpl() {
+KyteaChar * KyteaString::getWritableChars() {
+    if(isInline())
+        return inline_;
     if(impl_->count_ != 1) {
-        impl_->dec();
-        impl_ = new KyteaStringImpl(*impl_);
+        KyteaStringImpl * copy = KyteaStringImpl::create(*impl_);
+        release();
+        impl_ = copy;
     }
-    return impl_;
+    return impl_->chars_;
 }
 bool KyteaString::beginsWith(const KyteaString & s) const {
     if(s.length() > this->length()) return 0;
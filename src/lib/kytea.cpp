@@ -19,17 +19,36 @@
 #include <cmath>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <iomanip>
 #include <kytea/config.h>
 #include <kytea/kytea.h>
 #include <kytea/dictionary.h>
 #include <kytea/corpus-io.h>
 #include <kytea/model-io.h>
 #include <kytea/feature-io.h>
+#include <kytea/feature-shard.h>
 #include <kytea/dictionary.h>
 #include <kytea/string-util.h>
 #include <kytea/kytea-util.h>
 #include <kytea/kytea-lm.h>
 #include <kytea/feature-lookup.h>
+#include <kytea/analysis-scratch.h>
+#include <kytea/parallel.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 using namespace kytea;
 using namespace std;
@@ -127,6 +146,33 @@ void Kytea::scanDictionaries(const vector<string> & dict, typename Dictionary<En
     }
 }
 
+// Whether a sentence has any annotation that can be used in training
+static bool isTrainingSentence(const KyteaSentence & sent) {
+    for(unsigned i = 0; i < sent.words.size(); i++)
+        if(sent.words[i].isCertain)
+            return true;
+    for(unsigned i = 0; i < sent.wsConfs.size(); i++)
+        if(sent.wsConfs[i] != 0)
+            return true;
+    return false;
+}
+
+// The file that the training examples of a pass over the corpora are
+//  written to when streaming, or an empty string if they are kept in memory.
+//  The process id and a counter keep the files of trainings that share the
+//  directory apart.
+static string shardFile(const KyteaConfig & config, const string & name) {
+    if(!config.getStreaming())
+        return "";
+    static atomic<unsigned> count(0);
+    ostringstream buff;
+    buff << config.getStreamDir() << "/kytea-" << getpid() << "-" << count++ << "-" << name << ".shard";
+    return buff.str();
+}
+
+// The number of sentences that are read at once when streaming
+const static unsigned STREAM_SENTENCES = 4096;
+
 void Kytea::buildVocabulary() {
 
     Dictionary<ModelTagEntry>::WordMap & allWords = fio_->getWordMap();
@@ -138,6 +184,8 @@ void Kytea::buildVocabulary() {
     vector<string> corpora = config_->getCorpusFiles();
     vector<CorpusFormat> corpForm = config_->getCorpusFormats();
     int maxTag = config_->getNumTags();
+    unsigned numSentences = 0;
+    corpusTags_ = config_->getNumTags();
     for(unsigned i = 0; i < corpora.size(); i++) {
         if(config_->getDebug() > 0)
             cerr << "Reading corpus from " << corpora[i] << " ";
@@ -147,7 +195,6 @@ void Kytea::buildVocabulary() {
         int lines = 0;
         while((next = io->readSentence())) {
             lines++;
-            bool toAdd = false;
             for(unsigned i = 0; i < next->words.size(); i++) {
                 if(next->words[i].isCertain) {
                     maxTag = max(next->words[i].getNumTags(),maxTag);
@@ -156,17 +203,17 @@ void Kytea::buildVocabulary() {
                             addTag<ModelTagEntry>(allWords, next->words[i].norm, j, &next->words[i].getTagSurf(j), -1);
                     if(next->words[i].getNumTags() == 0)
                         addTag<ModelTagEntry>(allWords, next->words[i].norm, 0, 0, -1);
-                    
-                    toAdd = true;
                 }
             }
-            const unsigned wsSize = next->wsConfs.size();
-            for(unsigned i = 0; !toAdd && i < wsSize; i++)
-                toAdd = (next->wsConfs[i] != 0);
-            if(toAdd)
-                sentences_.push_back(next);
-            else
-                delete next;
+            // when streaming, the sentences are read again for training
+            if(isTrainingSentence(*next)) {
+                numSentences++;
+                if(!config_->getStreaming()) {
+                    sentences_.push_back(next);
+                    continue;
+                }
+            }
+            delete next;
         }
         if(config_->getDebug() > 0) {
             if(lines)
@@ -181,7 +228,7 @@ void Kytea::buildVocabulary() {
     // scan the dictionaries
     scanDictionaries<ModelTagEntry>(config_->getDictionaryFiles(), allWords, config_, util_, true);
 
-    if(sentences_.size() == 0 && fio_->getFeatures().size() == 0)
+    if(numSentences == 0 && fio_->getFeatures().size() == 0)
         THROW_ERROR("There were no sentences in the training data. Check to make sure your training file contains sentences.");
 
     if(config_->getDebug() > 0)
@@ -197,6 +244,40 @@ void Kytea::buildVocabulary() {
 
 }
 
+void Kytea::forTrainingSentences(const function<void(const Sentences &)> & func) {
+    if(!config_->getStreaming()) {
+        func(sentences_);
+        return;
+    }
+    vector<string> corpora = config_->getCorpusFiles();
+    vector<CorpusFormat> corpForm = config_->getCorpusFormats();
+    Sentences sents;
+    for(unsigned i = 0; i < corpora.size(); i++) {
+        CorpusIO * io = CorpusIO::createIO(corpora[i].c_str(), corpForm[i], *config_, false, util_);
+        io->setNumTags(corpusTags_);
+        KyteaSentence* next;
+        while((next = io->readSentence())) {
+            if(!isTrainingSentence(*next)) {
+                delete next;
+                continue;
+            }
+            sents.push_back(next);
+            if(sents.size() == STREAM_SENTENCES) {
+                func(sents);
+                for(unsigned j = 0; j < sents.size(); j++)
+                    delete sents[j];
+                sents.clear();
+            }
+        }
+        delete io;
+    }
+    if(sents.size() > 0) {
+        func(sents);
+        for(unsigned j = 0; j < sents.size(); j++)
+            delete sents[j];
+    }
+}
+
 /////////////////////////////////
 // Word segmentation functions //
 /////////////////////////////////
@@ -247,6 +328,11 @@ unsigned Kytea::wsDictionaryFeatures(const KyteaString & chars, SentenceFeatures
     return ret;
 }
 unsigned Kytea::wsNgramFeatures(const KyteaString & chars, SentenceFeatures & features, const vector<KyteaString> & prefixes, int n) {
+    return wsNgramFeatures(chars, features, prefixes, n, *wsModel_);
+}
+
+template <class FeatMap>
+unsigned Kytea::wsNgramFeatures(const KyteaString & chars, SentenceFeatures & features, const vector<KyteaString> & prefixes, int n, FeatMap & featMap) {
     const int featSize = (int)features.size(), 
             charLength = (int)chars.length(),
             w = (int)prefixes.size()/2;
@@ -261,7 +347,7 @@ unsigned Kytea::wsNgramFeatures(const KyteaString & chars, SentenceFeatures & fe
             const int nextRight = min(j+n, rightBound);
             for(int k = j; k<nextRight; k++) {
                 str = str+chars[k];
-                thisFeat = wsModel_->mapFeat(str);
+                thisFeat = featMap.mapFeat(str);
                 if(thisFeat) {
                     myFeats.push_back(thisFeat);
                     ret++;
@@ -304,6 +390,54 @@ void Kytea::preparePrefixes() {
     }
 }
 
+void Kytea::trainClassifiers(const vector<TagTriplet*> & trips) {
+    const unsigned numPoints = max((unsigned)sweepResults_.size(), 1u);
+    vector< vector<KyteaModel*> > mods(trips.size());
+    for(unsigned i = 0; i < trips.size(); i++) {
+        KyteaModel * model = trips[i]->third;
+        mods[i].push_back(model);
+        if(numPoints == 1)
+            continue;
+        // the examples are shared by all points, so their biases are set
+        // before the threads start, and the other points start as copies
+        // of the untrained classifier (which has no feature lookup yet)
+        model->setBias(config_->getBias());
+        trips[i]->first.setBias(model->getBiasId(), config_->getBias());
+        for(unsigned g = 1; g < numPoints; g++)
+            mods[i].push_back(new KyteaModel(*model));
+        sweepMods_.push_back(mods[i]);
+    }
+    vector< pair<size_t,unsigned> > order;
+    for(unsigned i = 0; i < trips.size(); i++) {
+        size_t size = trips[i]->first.getNumFeatures()+trips[i]->first.size();
+        for(unsigned g = 0; g < numPoints; g++)
+            order.push_back(pair<size_t,unsigned>(size, i*numPoints+g));
+    }
+    sort(order.begin(), order.end(), [](const pair<size_t,unsigned> & a, const pair<size_t,unsigned> & b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    // Each classifier has its own model, so they can be trained on separate
+    // threads, and the models are the same whatever order they are trained
+    // in. Threads that are left over are used by the solvers.
+    const unsigned numThreads = config_->getNumThreads();
+    const int solverThreads = max(numThreads/max((unsigned)order.size(), 1u), 1u);
+    mutex timeMutex;
+    parallelFor(numThreads, order.size(), [&](unsigned j) {
+        const unsigned i = order[j].second/numPoints, g = order[j].second%numPoints;
+        TagTriplet * trip = trips[i];
+        if(sweepResults_.size() == 0) {
+            trip->third->trainModel(trip->first,trip->second,config_->getBias(),config_->getSolverType(),config_->getEpsilon(),config_->getCost(),solverThreads);
+            return;
+        }
+        SweepResult & point = sweepResults_[g];
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        mods[i][g]->trainModel(trip->first,trip->second,config_->getBias(),point.solver,config_->getEpsilon(),point.cost,solverThreads);
+        chrono::duration<double> elapsed = chrono::steady_clock::now()-start;
+        lock_guard<mutex> lock(timeMutex);
+        point.time += elapsed.count();
+    });
+}
+
 void Kytea::trainWS() {
     if(wsModel_)
         delete wsModel_;
@@ -315,37 +449,30 @@ void Kytea::trainWS() {
 
     if(config_->getDebug() > 0)
         cerr << "Creating word segmentation features ";
-    // create word prefixes
-    vector<unsigned> dictFeats;
-    bool hasDictionary = (dict_->getNumDicts() > 0 && dict_->getStates().size() > 0);
     preparePrefixes();
-    // make the sentence features one by one
     unsigned scount = 0;
-    vector< vector<unsigned> > & xs = trip->first;
+    FeatureMatrix & xs = trip->first;
     vector<int> & ys = trip->second;
-    for(Sentences::const_iterator it = sentences_.begin(); it != sentences_.end(); it++) {
-        if(++scount % 1000 == 0)
-            cerr << ".";
-        KyteaSentence * sent = *it;
-        SentenceFeatures feats(sent->wsConfs.size());
-        unsigned fts = 0;
-        if(hasDictionary)
-            fts += wsDictionaryFeatures(sent->norm, feats);
-        fts += wsNgramFeatures(sent->norm, feats, charPrefixes_, config_->getCharN());
-        string str = util_->getTypeString(sent->norm);
-        fts += wsNgramFeatures(util_->mapString(str), feats, typePrefixes_, config_->getTypeN());
-        for(unsigned i = 0; i < feats.size(); i++) {
-            if(abs(sent->wsConfs[i]) > config_->getConfidence()) {
-                xs.push_back(feats[i]);
-                ys.push_back(sent->wsConfs[i]>1?1:-1);
-            }
-        }
-    }
+    if(config_->getStreaming()) {
+        // the examples of each group of sentences are spilled to disk, and
+        // only loaded once the size of the whole matrix is known
+        FeatureShard shard(shardFile(*config_, "ws"));
+        FeatureMatrix partXs;
+        vector<int> partYs;
+        forTrainingSentences([&](const Sentences & sents) {
+            wsFeatures(sents, partXs, partYs, scount);
+            shard.add(trip, partXs, partYs);
+            partXs.clear();
+            partYs.clear();
+        });
+        shard.load();
+    } else
+        wsFeatures(sentences_, xs, ys, scount);
     if(config_->getDebug() > 0)
         cerr << " done!" << endl << "Building classifier ";
 
     // train the model
-    wsModel_->trainModel(xs,ys,config_->getBias(),config_->getSolverType(),config_->getEpsilon(),config_->getCost());
+    trainClassifiers(vector<TagTriplet*>(1, trip));
 
     if(config_->getDebug() > 0)
         cerr << " done!" << endl;
@@ -355,6 +482,71 @@ void Kytea::trainWS() {
 }
 
 
+void Kytea::wsFeatures(const Sentences & sents, FeatureMatrix & xs, vector<int> & ys, unsigned & count) {
+    bool hasDictionary = (dict_->getNumDicts() > 0 && dict_->getNumStates() > 0);
+    // the type strings are mapped first, as mapping may add characters to
+    // the StringUtil
+    vector<KyteaString> typeStrs(sents.size());
+    for(unsigned i = 0; i < sents.size(); i++)
+        typeStrs[i] = util_->mapString(util_->getTypeString(sents[i]->norm));
+    // add the examples of sentences start to end to partXs and partYs,
+    // mapping the features with featMap
+    auto extract = [&](unsigned start, unsigned end, auto & featMap, FeatureMatrix & partXs, vector<int> & partYs) {
+        // the features of each boundary of a sentence, which are reused
+        SentenceFeatures feats;
+        for(unsigned s = start; s < end; s++) {
+            const KyteaSentence * sent = sents[s];
+            feats.resize(sent->wsConfs.size());
+            for(unsigned i = 0; i < feats.size(); i++)
+                feats[i].clear();
+            if(hasDictionary)
+                wsDictionaryFeatures(sent->norm, feats);
+            wsNgramFeatures(sent->norm, feats, charPrefixes_, config_->getCharN(), featMap);
+            wsNgramFeatures(typeStrs[s], feats, typePrefixes_, config_->getTypeN(), featMap);
+            for(unsigned i = 0; i < feats.size(); i++) {
+                if(abs(sent->wsConfs[i]) > config_->getConfidence()) {
+                    partXs.push_back(feats[i]);
+                    partYs.push_back(sent->wsConfs[i]>1?1:-1);
+                }
+            }
+        }
+    };
+    const unsigned numThreads = config_->getNumThreads();
+    const unsigned numParts = min((unsigned)sents.size(), numThreads*4);
+    if(numThreads <= 1 || numParts <= 1) {
+        // on one thread, the examples go straight into xs
+        extract(0, sents.size(), *wsModel_, xs, ys);
+    } else {
+        // make the features of each part of the corpus separately, each with
+        // its own map of new features, and add the parts to the model in
+        // order so the features are numbered as if the sentences had been
+        // handled one by one
+        vector<FeatureMatrix> partXs(numParts);
+        vector< vector<int> > partYs(numParts);
+        vector<LocalFeatureMap> partMaps(numParts, LocalFeatureMap(wsModel_));
+        parallelFor(numThreads, numParts, [&](unsigned p) {
+            const unsigned start = (unsigned)((size_t)sents.size()*p/numParts),
+                           end = (unsigned)((size_t)sents.size()*(p+1)/numParts);
+            extract(start, end, partMaps[p], partXs[p], partYs[p]);
+        });
+        // each part is freed as soon as it is in xs, so the examples are
+        // never all held twice
+        for(unsigned p = 0; p < numParts; p++) {
+            partMaps[p].addToModel(wsModel_, partXs[p]);
+            if(xs.size() == 0)
+                xs.swap(partXs[p]);
+            else
+                xs.append(partXs[p]);
+            partXs[p].clear();
+            ys.insert(ys.end(), partYs[p].begin(), partYs[p].end());
+            vector<int>().swap(partYs[p]);
+        }
+    }
+    for(unsigned s = 0; s < sents.size(); s++)
+        if(++count % 1000 == 0)
+            cerr << ".";
+}
+
 //////////////////////////////
 // Tag estimation functions //
 //////////////////////////////
@@ -422,37 +614,40 @@ void Kytea::trainGlobalTags(int lev) {
     KyteaString kssx = util_->mapString("SX"), ksst = util_->mapString("ST");
     
     // build features
-    for(Sentences::const_iterator it = sentences_.begin(); it != sentences_.end(); it++) {
-        int startPos = 0, finPos=0;
-        KyteaString charStr = (*it)->norm;
-        KyteaString typeStr = util_->mapString(util_->getTypeString(charStr));
-        for(unsigned j = 0; j < (*it)->words.size(); j++) {
-            startPos = finPos;
-            KyteaWord & word = (*it)->words[j];
-            finPos = startPos+word.norm.length();
-            if(!word.getTag(lev) || word.getTagConf(lev) <= config_->getConfidence())
-                continue;
-            unsigned myTag;
-            KyteaString tagSurf = word.getTagSurf(lev);
-            for(myTag = 0; myTag < trip->fourth.size() && tagSurf != trip->fourth[myTag]; myTag++);
-            if(myTag == trip->fourth.size()) 
-                trip->fourth.push_back(tagSurf);
-            myTag++;
-            vector<unsigned> feat;
-            tagNgramFeatures(charStr, feat, charPrefixes_, trip->third, config_->getCharN(), startPos-1, finPos);
-            tagNgramFeatures(typeStr, feat, typePrefixes_, trip->third, config_->getTypeN(), startPos-1, finPos);
-            tagSelfFeatures(word.norm, feat, kssx, trip->third);
-            tagSelfFeatures(util_->mapString(util_->getTypeString(word.norm)), feat, ksst, trip->third);
-            tagDictFeatures(word.norm, lev, feat, trip->third);
-            trip->first.push_back(feat);
-            trip->second.push_back(myTag);
+    FeatureShard shard(shardFile(*config_, "global"));
+    forTrainingSentences([&](const Sentences & sents) {
+        for(Sentences::const_iterator it = sents.begin(); it != sents.end(); it++) {
+            int startPos = 0, finPos=0;
+            KyteaString charStr = (*it)->norm;
+            KyteaString typeStr = util_->mapString(util_->getTypeString(charStr));
+            for(unsigned j = 0; j < (*it)->words.size(); j++) {
+                startPos = finPos;
+                KyteaWord & word = (*it)->words[j];
+                finPos = startPos+word.norm.length();
+                if(!word.getTag(lev) || word.getTagConf(lev) <= config_->getConfidence())
+                    continue;
+                unsigned myTag;
+                KyteaString tagSurf = word.getTagSurf(lev);
+                for(myTag = 0; myTag < trip->fourth.size() && tagSurf != trip->fourth[myTag]; myTag++);
+                if(myTag == trip->fourth.size()) 
+                    trip->fourth.push_back(tagSurf);
+                myTag++;
+                vector<unsigned> feat;
+                tagNgramFeatures(charStr, feat, charPrefixes_, trip->third, config_->getCharN(), startPos-1, finPos);
+                tagNgramFeatures(typeStr, feat, typePrefixes_, trip->third, config_->getTypeN(), startPos-1, finPos);
+                tagSelfFeatures(word.norm, feat, kssx, trip->third);
+                tagSelfFeatures(util_->mapString(util_->getTypeString(word.norm)), feat, ksst, trip->third);
+                tagDictFeatures(word.norm, lev, feat, trip->third);
+                shard.add(trip, feat, myTag);
+            }
         }
-    }
+    });
+    shard.load();
     if(config_->getDebug() > 0)
         cerr << "done!" << endl << "Training global tag classifiers ";
 
 
-    trip->third->trainModel(trip->first,trip->second,config_->getBias(),config_->getSolverType(),config_->getEpsilon(),config_->getCost()); 
+    trainClassifiers(vector<TagTriplet*>(1, trip));
 
     globalTags_[lev] = trip->fourth;
     if(config_->getDebug() > 0)
@@ -502,47 +697,54 @@ void Kytea::trainLocalTags(int lev) {
         }
     }
     // build features
-    for(Sentences::const_iterator it = sentences_.begin(); it != sentences_.end(); it++) {
-        int startPos = 0, finPos=0;
-        KyteaString charStr = (*it)->norm;
-        KyteaString typeStr = util_->mapString(util_->getTypeString(charStr));
-        for(unsigned j = 0; j < (*it)->words.size(); j++) {
-            startPos = finPos;
-            KyteaWord & word = (*it)->words[j];
-            finPos = startPos+word.norm.length();
-            if(!word.getTag(lev) || word.getTagConf(lev) <= config_->getConfidence())
-                continue;
-            TagTriplet * trip = fio_->getFeatures(featId+word.norm,false);
-            if(trip) {
-                unsigned myTag = dict_->getTagID(word.norm,word.getTagSurf(lev),lev);
-                if(myTag != 0) {
-                    vector<unsigned> feat;
-                    tagNgramFeatures(charStr, feat, charPrefixes_, trip->third, config_->getCharN(), startPos-1, finPos);
-                    tagNgramFeatures(typeStr, feat, typePrefixes_, trip->third, config_->getTypeN(), startPos-1, finPos);
-                    trip->first.push_back(feat);
-                    trip->second.push_back(myTag);
+    FeatureShard shard(shardFile(*config_, "local"));
+    forTrainingSentences([&](const Sentences & sents) {
+        for(Sentences::const_iterator it = sents.begin(); it != sents.end(); it++) {
+            int startPos = 0, finPos=0;
+            KyteaString charStr = (*it)->norm;
+            KyteaString typeStr = util_->mapString(util_->getTypeString(charStr));
+            for(unsigned j = 0; j < (*it)->words.size(); j++) {
+                startPos = finPos;
+                KyteaWord & word = (*it)->words[j];
+                finPos = startPos+word.norm.length();
+                if(!word.getTag(lev) || word.getTagConf(lev) <= config_->getConfidence())
+                    continue;
+                TagTriplet * trip = fio_->getFeatures(featId+word.norm,false);
+                if(trip) {
+                    unsigned myTag = dict_->getTagID(word.norm,word.getTagSurf(lev),lev);
+                    if(myTag != 0) {
+                        vector<unsigned> feat;
+                        tagNgramFeatures(charStr, feat, charPrefixes_, trip->third, config_->getCharN(), startPos-1, finPos);
+                        tagNgramFeatures(typeStr, feat, typePrefixes_, trip->third, config_->getTypeN(), startPos-1, finPos);
+                        shard.add(trip, feat, myTag);
+                    }
                 }
             }
         }
-    }
+    });
+    shard.load();
     if(config_->getDebug() > 0)
         cerr << "done!" << endl << "Training local tag classifiers ";
     // calculate classifiers
+    vector<ModelTagEntry*> jobs;
+    vector<TagTriplet*> trips;
     for(unsigned i = 0; i < entries.size(); i++) {
         myEntry = entries[i];
         if((int)myEntry->tags.size() > lev && (myEntry->tags[lev].size() > 1 || config_->getWriteFeatures())) {
             TagTriplet * trip = fio_->getFeatures(featId+myEntry->word,false);
             if(!trip) THROW_ERROR("FATAL: Unbuilt model in entry table");
-            vector< vector<unsigned> > & xs = trip->first;
-            vector<int> & ys = trip->second;
-            
-            // train the model
-            trip->third->trainModel(xs,ys,config_->getBias(),config_->getSolverType(),config_->getEpsilon(),config_->getCost());
-            if(trip->third->getNumClasses() == 1) {
-                int myLab = trip->third->getLabel(0)-1;
-                KyteaString tmpString = myEntry->tags[lev][0]; myEntry->tags[lev][0] = myEntry->tags[lev][myLab]; myEntry->tags[lev][myLab] = tmpString;
-                char tmpDict = myEntry->tagInDicts[lev][0]; myEntry->tagInDicts[lev][0] = myEntry->tagInDicts[lev][myLab]; myEntry->tagInDicts[lev][myLab] = tmpDict;
-            }
+            jobs.push_back(myEntry);
+            trips.push_back(trip);
+        }
+    }
+    trainClassifiers(trips);
+    // the labels are the same for every point of a sweep
+    for(unsigned i = 0; i < jobs.size(); i++) {
+        myEntry = jobs[i];
+        if(trips[i]->third->getNumClasses() == 1) {
+            int myLab = trips[i]->third->getLabel(0)-1;
+            KyteaString tmpString = myEntry->tags[lev][0]; myEntry->tags[lev][0] = myEntry->tags[lev][myLab]; myEntry->tags[lev][myLab] = tmpString;
+            char tmpDict = myEntry->tagInDicts[lev][0]; myEntry->tagInDicts[lev][0] = myEntry->tagInDicts[lev][myLab]; myEntry->tagInDicts[lev][myLab] = tmpDict;
         }
     }
 
@@ -553,10 +755,13 @@ void Kytea::trainLocalTags(int lev) {
         cerr << "done!" << endl;
 }
 
-vector<pair<int,int> > Kytea::getDictionaryMatches(const KyteaString & surf, int lev) {
+vector<pair<int,int> > Kytea::getDictionaryMatches(const KyteaStringView & surf, int lev) const {
+    if(!dict_) return vector<pair<int,int> >();
+    return getDictionaryMatches(dict_->findEntry(surf), lev);
+}
+
+vector<pair<int,int> > Kytea::getDictionaryMatches(const ModelTagEntry * ent, int lev) const {
     vector<pair<int,int> > ret;
-    if(!dict_) return ret;
-    const ModelTagEntry* ent = dict_->findEntry(surf);
     if(ent == 0 || ent->inDict == 0 || (int)ent->tagInDicts.size() <= lev)
         return ret;
     // For each tag
@@ -596,6 +801,8 @@ void Kytea::trainSanityCheck() {
         THROW_ERROR("The maximum number of dictionaries that can be specified is 8.");
     } else if(config_->getModelFile().length() == 0) {
         THROW_ERROR("An output model file must be specified when training (-model)");
+    } else if(config_->getSweeping() && config_->getHeldOut().length() == 0) {
+        THROW_ERROR("A held-out corpus must be specified (-heldout) to choose between the settings of -sweepcost/-sweepsolver");
     }
     // check to make sure the model can be output to
     ModelIO * modout = ModelIO::createIO(config_->getModelFile().c_str(),config_->getModelFormat(), true, *config_);
@@ -653,7 +860,7 @@ void Kytea::trainUnk(int lev) {
                         // if the current hypothesis matches the alignment hypothesis
                         const KyteaString & pstr = mySubEntry->tags[lev][k];
                         const unsigned pend = pstart+pstr.length();
-                        if(pend <= tag.length() && tag.substr(pstart,pend-pstart) == pstr) {
+                        if(pend <= tag.length() && KyteaStringView(tag,pstart,pend-pstart) == pstr) {
                             AlignHyp nextHyp = myHyp;
                             nextHyp.push_back( pair<unsigned,unsigned>(cend,pend) );
                             stacks[cend].push_back(nextHyp);
@@ -667,7 +874,7 @@ void Kytea::trainUnk(int lev) {
                 if(myHyp[myHyp.size()-1].second == tag.length()) {
                     tagCorpus.push_back(tag);
                     for(unsigned j = 1; j < myHyp.size(); j++) {
-                        KyteaString subChar = word.substr(myHyp[j-1].first,myHyp[j].first-myHyp[j-1].first);
+                        KyteaStringView subChar(word,myHyp[j-1].first,myHyp[j].first-myHyp[j-1].first);
                         KyteaString subTag = tag.substr(myHyp[j-1].second,myHyp[j].second-myHyp[j-1].second);
                         ProbTagEntry* mySubEntry = subwordDict_->findEntry(subChar);
                         mySubEntry->incrementProb(subTag,lev);
@@ -872,6 +1079,7 @@ void Kytea::readModel(const char* fileName) {
     
     // prepare the prefixes in advance for faster analysis
     preparePrefixes();
+    prepareAnalysis();
 
     if(config_->getDebug() > 0)    
         cerr << " done!" << endl;
@@ -882,7 +1090,27 @@ void Kytea::readModel(const char* fileName) {
 // Analysis functions //
 ////////////////////////
 
-void Kytea::calculateWS(KyteaSentence & sent) {
+const ModelTagEntry * Kytea::findWordEntry(KyteaWord & word) const {
+    if(word.entryDict != dict_ || dict_ == 0) {
+        word.entry = (dict_ ? dict_->findEntry(word.norm) : 0);
+        word.entryDict = dict_;
+    }
+    return word.entry;
+}
+
+// The character types of a sentence, which are found once and shared by word
+// segmentation and all of the tag levels
+static const KyteaString & sentenceTypes(AnalysisScratch & scratch, const KyteaString & norm, const StringUtil * util) {
+    if(scratch.typeUtil != util->getSerial() || scratch.typeNorm != norm) {
+        scratch.typeChars = util->getTypeKyteaString(norm);
+        scratch.typeNorm = norm;
+        scratch.typeUtil = util->getSerial();
+    }
+    return scratch.typeChars;
+}
+
+void Kytea::calculateWS(KyteaSentence & sent) const {
+    const StringUtil * util = util_;
     if(!wsModel_)
         THROW_ERROR("This model cannot be used for word segmentation.");
     
@@ -891,27 +1119,31 @@ void Kytea::calculateWS(KyteaSentence & sent) {
         return;
 
     // get the features for the sentence
+    AnalysisScratch & scratch = AnalysisScratch::get();
     FeatureLookup * featLookup = wsModel_->getFeatureLookup();
-    vector<FeatSum> scores(sent.norm.length()-1, featLookup->getBias(0));
+    vector<FeatSum> & scores = scratch.wsScores;
+    scores.assign(sent.norm.length()-1, featLookup->getBias(0));
     featLookup->addNgramScores(featLookup->getCharDict(), 
                                sent.norm, config_->getCharWindow(), 
                                scores);
-    const string & type_str = util_->getTypeString(sent.norm);
     featLookup->addNgramScores(featLookup->getTypeDict(), 
-                               util_->mapString(type_str), 
+                               sentenceTypes(scratch, sent.norm, util), 
                                config_->getTypeWindow(), scores);
     if(featLookup->getDictVector())
         featLookup->addDictionaryScores(
-            dict_->match(sent.norm),
+            dict_, sent.norm,
             dict_->getNumDicts(), config_->getDictionaryN(),
             scores);
     
     // If the characters match the hard constraint, OK
     const string & wsc = config_->getWsConstraint();
-    if(wsc.size())
+    if(wsc.size()) {
+        const string & type_str = scratch.typeStr;
+        util->getTypeString(sent.norm, scratch.typeStr);
         for(unsigned i = 0; i < scores.size(); i++)
             if(type_str[i]==type_str[i+1] && wsc.find(type_str[i]) != std::string::npos)
                 scores[i] = KyteaModel::isProbabilistic(config_->getSolverType())?0:-100;
+    }
 
     // Update values, but only ones that are not already sure
     for(unsigned i = 0; i < sent.wsConfs.size(); i++)
@@ -920,7 +1152,7 @@ void Kytea::calculateWS(KyteaSentence & sent) {
     sent.refreshWS(config_->getConfidence());
     for(int i = 0; i < (int)sent.words.size(); i++) {
         KyteaWord & word = sent.words[i];
-        word.setUnknown(dict_->findEntry(word.norm) == 0);
+        word.setUnknown(findWordEntry(word) == 0);
     }
     if(KyteaModel::isProbabilistic(config_->getSolverType())) {
         for(unsigned i = 0; i < sent.wsConfs.size(); i++)
@@ -933,97 +1165,150 @@ bool kyteaTagMore(const KyteaTag a, const KyteaTag b) {
     return a.second > b.second;
 }
 
+// the tag string of a lattice node, or only its last maxLen characters
+static KyteaString unkNodeString(const vector<UnkTagNode> & nodes, unsigned id, unsigned maxLen) {
+    const unsigned fullLen = nodes[id].length;
+    const unsigned len = min(fullLen, maxLen);
+    KyteaString ret(len);
+    int pos = fullLen;
+    for(unsigned n = id; n != 0 && pos > (int)(fullLen-len); n = nodes[n].back) {
+        const KyteaString & tag = *nodes[n].tag;
+        for(int i = tag.length()-1; i >= 0 && --pos >= (int)(fullLen-len); i--)
+            ret[pos-(fullLen-len)] = tag[i];
+    }
+    return ret;
+}
+
 # define BEAM_SIZE 50
-vector< KyteaTag > Kytea::generateTagCandidates(const KyteaString & str, int lev) {
+vector< KyteaTag > Kytea::generateTagCandidates(const KyteaString & str, int lev) const {
     // cerr << "generateTagCandidates("<<util_->showString(str)<<")"<<endl;
-    Dictionary<ProbTagEntry>::MatchResult matches = subwordDict_->match(str);
-    vector< vector< KyteaTag > > stack(str.length()+1);
-    stack[0].push_back(KyteaTag(KyteaString(),0));
+    const KyteaLM * lm = subwordModels_[lev];
+    // packed models are scored from the LM state, others from the end of
+    //  the string of the previous node
+    const bool packed = lm->isPacked();
+    const unsigned beam = config_->getUnkBeam();
+    AnalysisScratch & scratch = AnalysisScratch::get();
+    vector<UnkTagNode> & nodes = scratch.unkNodes;
+    vector< vector<unsigned> > & stacks = scratch.unkStacks;
+    nodes.clear();
+    if(stacks.size() < str.length()+1)
+        stacks.resize(str.length()+1);
+    for(unsigned i = 0; i <= str.length(); i++)
+        stacks[i].clear();
+    nodes.push_back(UnkTagNode(0, 0, 0, lm->getStartState(), 0));
+    stacks[0].push_back(0);
+    // ties are broken by the order of the nodes, so pruning is deterministic
+    auto nodeMore = [&nodes](unsigned a, unsigned b) {
+        return nodes[a].score > nodes[b].score || (nodes[a].score == nodes[b].score && a < b);
+    };
     unsigned end, start, lastEnd = 0;
-    for(unsigned i = 0; i < matches.size(); i++) {
-        // cerr << " match "<<util_->showString(matches[i].second->word)<<" "<<matches[i].first<<endl;
-        ProbTagEntry* entry = matches[i].second;
-        end = matches[i].first+1;
+    KyteaString context;
+    subwordDict_->visitMatches(str, [&](unsigned matchEnd, unsigned id) {
+        // cerr << " match "<<util_->showString(entry->word)<<" "<<matchEnd<<endl;
+        const ProbTagEntry* entry = subwordDict_->getEntry(id);
+        end = matchEnd+1;
         start = end-entry->word.length();
         // trim to the beam size
-        if(end != lastEnd && config_->getUnkBeam() > 0 && stack[lastEnd].size() > config_->getUnkBeam()) {
-            sort(stack[lastEnd].begin(), stack[lastEnd].end(), kyteaTagMore);
-            stack[lastEnd].resize(config_->getUnkBeam());
+        vector<unsigned> & trim = stacks[lastEnd];
+        if(end != lastEnd && beam > 0 && trim.size() > beam) {
+            partial_sort(trim.begin(), trim.begin()+beam, trim.end(), nodeMore);
+            trim.resize(beam);
         }
         lastEnd = end;
         // expand the hypotheses
         for(unsigned j = 0; j < entry->tags[lev].size(); j++) {
-            for(unsigned k = 0; k < stack[start].size(); k++) {
-                KyteaTag nextPair(
-                    stack[start][k].first+entry->tags[lev][j],
-                    stack[start][k].second+entry->probs[lev][j]
-                );
-                // cerr << "  ("<<start<<","<<end<<") "<<util_->showString(entry->word)<<", "<<util_->showString(nextPair.first)<<"/"<<nextPair.second;
-                for(unsigned pos = stack[start][k].first.length(); pos < nextPair.first.length(); pos++) {
-                    nextPair.second += subwordModels_[lev]->scoreSingle(nextPair.first,pos);
-                    // cerr << "-->" << nextPair.second;
+            const KyteaString & tag = entry->tags[lev][j];
+            for(unsigned k = 0; k < stacks[start].size(); k++) {
+                const unsigned prev = stacks[start][k];
+                UnkTagNode next(prev, &tag, nodes[prev].score+entry->probs[lev][j],
+                                nodes[prev].state, nodes[prev].length+tag.length());
+                if(packed) {
+                    for(unsigned pos = 0; pos < tag.length(); pos++)
+                        next.score += lm->scoreNext(next.state, tag[pos]);
+                } else {
+                    context = unkNodeString(nodes, prev, lm->n_-1) + tag;
+                    for(unsigned pos = context.length()-tag.length(); pos < context.length(); pos++)
+                        next.score += lm->scoreSingle(context, pos);
                 }
-                // cerr << endl;
-                stack[end].push_back(nextPair);
+                stacks[end].push_back(nodes.size());
+                nodes.push_back(next);
             }
         }
+    });
+    // add the score of the end of the string, and convert to probabilities
+    const vector<unsigned> & last = stacks[str.length()];
+    vector<double> probs(last.size());
+    double maxProb = -1e20, totalProb = 0;
+    for(unsigned i = 0; i < last.size(); i++) {
+        const UnkTagNode & node = nodes[last[i]];
+        if(packed) {
+            KyteaLMState state = node.state;
+            probs[i] = node.score + lm->scoreNext(state, 0);
+        } else {
+            context = unkNodeString(nodes, last[i], lm->n_-1);
+            probs[i] = node.score + lm->scoreSingle(context, context.length());
+        }
+        maxProb = max(maxProb,probs[i]);
     }
-    vector<KyteaTag> ret = stack[stack.size()-1];
-    for(unsigned i = 0; i < ret.size(); i++)
-        ret[i].second += subwordModels_[lev]->scoreSingle(ret[i].first,ret[i].first.length());
+    for(unsigned i = 0; i < probs.size(); i++) {
+        probs[i] = exp(probs[i]-maxProb);
+        totalProb += probs[i];
+    }
+    for(unsigned i = 0; i < probs.size(); i++)
+        probs[i] /= totalProb;
+    // build the strings of the candidates that can be in the top tagMax,
+    //  including any that are tied with the last one (and any that are not
+    //  a number, which are kept as the model does not give them a score)
+    const unsigned tagMax = config_->getTagMax();
+    double minProb = -1;
+    if(tagMax != 0 && tagMax < probs.size()) {
+        vector<double> sorted = probs;
+        nth_element(sorted.begin(), sorted.begin()+tagMax-1, sorted.end(), greater<double>());
+        minProb = sorted[tagMax-1];
+    }
+    vector<KyteaTag> ret;
+    for(unsigned i = 0; i < last.size(); i++)
+        if(!(probs[i] < minProb))
+            ret.push_back(KyteaTag(unkNodeString(nodes, last[i], nodes[last[i]].length), probs[i]));
+    sort(ret.begin(), ret.end());
+    if(tagMax != 0 && tagMax < ret.size())
+        ret.resize(tagMax);
     return ret;
 }
-void Kytea::calculateUnknownTag(KyteaWord & word, int lev) {
+void Kytea::calculateUnknownTag(KyteaWord & word, int lev) const {
     // cerr << "calculateUnknownTag("<<util_->showString(word.surf)<<")"<<endl;
     if(lev >= (int)subwordModels_.size() || subwordModels_[lev] == 0) return;
-    if(word.norm.length() > 256) {
-        cerr << "WARNING: skipping pronunciation estimation for extremely long unknown word of length "
-            <<word.norm.length()<<" starting with '"
-            <<util_->showString(word.norm.substr(0,20))<<"'"<<endl;
-        word.addTag(lev, KyteaTag(util_->mapString("<NULL>"),0));
-        return;
-    }
-    // generate candidates
     if((int)word.tags.size() <= lev) word.tags.resize(lev+1);
-    word.tags[lev] = generateTagCandidates(word.norm, lev);
     vector<KyteaTag> & tags = word.tags[lev];
-    // get the max
-    double maxProb = -1e20, totalProb = 0;
-    for(unsigned i = 0; i < tags.size(); i++)
-        maxProb = max(maxProb,tags[i].second);
-    // convert to prob and get the normalizing constant
-    for(unsigned i = 0; i < tags.size(); i++) {
-        tags[i].second = exp(tags[i].second-maxProb);
-        totalProb += tags[i].second;
-    }
-    // normalize the values
-    for(unsigned i = 0; i < tags.size(); i++)
-        tags[i].second /= totalProb;
-    sort(tags.begin(), tags.end());
-    // trim the number of candidates
-    if(config_->getTagMax() != 0 && config_->getTagMax() < tags.size())
-        tags.resize(config_->getTagMax());
-
+    // check if the word has been estimated recently
+    UnkTagKey key(word.norm, lev, config_->getUnkBeam(), config_->getTagMax());
+    if(unkCache_ && unkCache_->find(key, tags))
+        return;
+    // generate the most likely candidates
+    tags = generateTagCandidates(word.norm, lev);
+    if(unkCache_)
+        unkCache_->add(key, tags);
 }
-void Kytea::calculateTags(KyteaSentence & sent, int lev) {
+void Kytea::calculateTags(KyteaSentence & sent, int lev) const {
+    const StringUtil * util = util_;
     int startPos = 0, finPos=0;
-    KyteaString charStr = sent.norm;
-    KyteaString typeStr = util_->mapString(util_->getTypeString(charStr));
-    KyteaString kssx = util_->mapString("SX"), ksst = util_->mapString("ST");
+    AnalysisScratch & scratch = AnalysisScratch::get();
+    const KyteaString & charStr = sent.norm;
+    const KyteaString & typeStr = sentenceTypes(scratch, charStr, util);
     const string & defTag = config_->getDefaultTag();
     for(unsigned i = 0; i < sent.words.size(); i++) {
         KyteaWord & word = sent.words[i];
+        startPos = finPos;
+        finPos = startPos+word.norm.length();
         if((int)word.tags.size() > lev
             && (int)word.tags[lev].size() > 0
             && abs(word.tags[lev][0].second) > config_->getConfidence())
                 continue;
-        startPos = finPos;
-        finPos = startPos+word.norm.length();
         // Find the word in the dictionary and set it to unknown if it is
-        ModelTagEntry* ent = dict_->findEntry(word.norm);
+        const ModelTagEntry* ent = findWordEntry(word);
         word.setUnknown(ent == 0);
         // choose whether to do local or global estimation
-        vector<KyteaString> * tags = 0;
+        const vector<KyteaString> * tags = 0;
         KyteaModel * tagMod = 0;
         bool useSelf = false;
         if(lev < (int)globalMods_.size() && globalMods_[lev] != 0) {
@@ -1040,7 +1325,7 @@ void Kytea::calculateTags(KyteaSentence & sent, int lev) {
             if(config_->getDoUnk()) {
                 calculateUnknownTag(word,lev);
                 if(config_->getDebug() >= 2)
-                    cerr << "Tag "<<i+1<<" ("<<util_->showString(sent.words[i].surface)<<"->UNK)"<<endl;
+                    cerr << "Tag "<<i+1<<" ("<<util->showString(sent.words[i].surface)<<"->UNK)"<<endl;
             }
         }
         // calculate known tags
@@ -1053,13 +1338,15 @@ void Kytea::calculateTags(KyteaSentence & sent, int lev) {
 #ifdef KYTEA_SAFE
                 if(look == NULL) THROW_ERROR("null lookure lookup during analysis");
 #endif
-                vector<FeatSum> scores(tagMod->getNumWeights(), 0);
+                vector<FeatSum> & scores = scratch.tagScores;
+                scores.assign(tagMod->getNumWeights(), 0);
                 look->addTagNgrams(charStr, look->getCharDict(), scores, config_->getCharN(), startPos, finPos);
                 look->addTagNgrams(typeStr, look->getTypeDict(), scores, config_->getTypeN(), startPos, finPos);
                 if(useSelf) {
-                    look->addSelfWeights(charStr.substr(startPos,finPos-startPos), scores, 0);
-                    look->addSelfWeights(typeStr.substr(startPos,finPos-startPos), scores, 1);
-                    look->addTagDictWeights(getDictionaryMatches(charStr.substr(startPos,finPos-startPos), 0), scores);
+                    KyteaStringView wordChars(charStr,startPos,finPos-startPos);
+                    look->addSelfWeights(wordChars, scores, 0);
+                    look->addSelfWeights(KyteaStringView(typeStr,startPos,finPos-startPos), scores, 1);
+                    look->addTagDictWeights(getDictionaryMatches(ent, 0), scores);
                 }
                 for(int j = 0; j < (int)scores.size(); j++) 
                     scores[j] += look->getBias(j);
@@ -1087,17 +1374,170 @@ void Kytea::calculateTags(KyteaSentence & sent, int lev) {
             }
         }
         if(!word.hasTag(lev) && defTag.length())
-            word.addTag(lev,KyteaTag(util_->mapString(defTag),0));
+            word.addTag(lev,KyteaTag(util->mapString(defTag),0));
         if(config_->getTagMax() > 0)
             word.limitTags(lev,config_->getTagMax());
     }
 }
 
+void Kytea::swapSweepModels(unsigned g) {
+    if(g == 0)
+        return;
+    for(unsigned i = 0; i < sweepMods_.size(); i++)
+        sweepMods_[i][0]->swap(*sweepMods_[i][g]);
+}
+
+void Kytea::testSweepModels(const Sentences & sents, SweepResult & result) {
+    // the correct words, the words found and the words in the corpus, then
+    // the correct tags and the words with tags for each level
+    const int numTags = config_->getNumTags();
+    vector< vector<unsigned> > counts(sents.size(), vector<unsigned>(3+2*numTags, 0));
+    parallelFor(config_->getNumThreads(), sents.size(), [&](unsigned s) {
+        const KyteaSentence & gold = *sents[s];
+        KyteaSentence sys(gold.surface, gold.norm);
+        if(!config_->getDoWS())
+            for(unsigned i = 0; i < gold.words.size(); i++)
+                sys.words.push_back(KyteaWord(gold.words[i].surface, gold.words[i].norm));
+        analyzeSentence(sys);
+        vector<unsigned> & count = counts[s];
+        count[1] = sys.words.size();
+        count[2] = gold.words.size();
+        for(unsigned i = 0; i < gold.words.size(); i++)
+            for(int lev = 0; lev < numTags; lev++)
+                if(gold.words[i].hasTag(lev))
+                    count[4+2*lev]++;
+        // match the words that have the same span
+        unsigned gi = 0, si = 0, gpos = 0, spos = 0;
+        while(gi < gold.words.size() && si < sys.words.size()) {
+            const KyteaWord & gw = gold.words[gi], & sw = sys.words[si];
+            unsigned gend = gpos+gw.norm.length(), send = spos+sw.norm.length();
+            if(gpos == spos && gend == send) {
+                count[0]++;
+                for(int lev = 0; lev < numTags; lev++)
+                    if(gw.hasTag(lev) && sw.hasTag(lev) && gw.getTagSurf(lev) == sw.getTagSurf(lev))
+                        count[3+2*lev]++;
+            }
+            if(gend <= send) { gpos = gend; gi++; }
+            if(send <= gend) { spos = send; si++; }
+        }
+    });
+    vector<unsigned> total(3+2*numTags, 0);
+    for(unsigned s = 0; s < counts.size(); s++)
+        for(unsigned i = 0; i < total.size(); i++)
+            total[i] += counts[s][i];
+    if(config_->getDoWS())
+        result.wsFMeas = (total[1]+total[2] ? 2.0*total[0]/(total[1]+total[2]) : 0);
+    result.tagAccs.resize(numTags, -1);
+    for(int lev = 0; lev < numTags; lev++)
+        if(config_->getDoTags() && config_->getDoTag(lev) && total[4+2*lev] > 0)
+            result.tagAccs[lev] = (double)total[3+2*lev]/total[4+2*lev];
+}
+
+// Make a copy of util, so characters can be added to it without changing
+//  the model's StringUtil
+static StringUtil * copyStringUtil(const StringUtil & util) {
+    StringUtil * ret;
+    if(util.getEncoding() == StringUtil::ENCODING_UTF8) ret = new StringUtilUtf8();
+    else if(util.getEncoding() == StringUtil::ENCODING_EUC) ret = new StringUtilEuc();
+    else ret = new StringUtilSjis();
+    ret->unserialize(util.serialize());
+    return ret;
+}
+
+// Map the characters of str that were added to copy after it was made
+//  from util (when util had numIds characters) to the ids that the const
+//  util gives them, which are those used when analyzing with the model
+static void mapUnseenChars(KyteaString & str, const StringUtil & util, const StringUtil & copy, unsigned numIds) {
+    for(unsigned i = 0; i < str.length(); i++)
+        if(str[i] >= numIds)
+            str[i] = util.mapChar(copy.showChar(str[i]));
+}
+
+void Kytea::chooseSweepModels() {
+    if(config_->getDebug() > 0)
+        cerr << "Testing the models on " << config_->getHeldOut() << endl;
+    // all strings must be mapped before the analysis functions are used
+    prepareAnalysis();
+    // the held-out corpus is read with a copy of the StringUtil, so none of
+    //  its characters are added to the model
+    StringUtil * heldUtil = copyStringUtil(*util_);
+    const unsigned numIds = util_->getNumCharIds();
+    CorpusIO * io = CorpusIO::createIO(config_->getHeldOut().c_str(), CORP_FORMAT_FULL, *config_, false, heldUtil);
+    io->setNumTags(config_->getNumTags());
+    Sentences sents;
+    KyteaSentence * next;
+    while((next = io->readSentence())) {
+        mapUnseenChars(next->surface, *util_, *heldUtil, numIds);
+        mapUnseenChars(next->norm, *util_, *heldUtil, numIds);
+        for(unsigned i = 0; i < next->words.size(); i++) {
+            KyteaWord & word = next->words[i];
+            mapUnseenChars(word.surface, *util_, *heldUtil, numIds);
+            mapUnseenChars(word.norm, *util_, *heldUtil, numIds);
+            for(unsigned lev = 0; lev < word.tags.size(); lev++)
+                for(unsigned j = 0; j < word.tags[lev].size(); j++)
+                    mapUnseenChars(word.tags[lev][j].first, *util_, *heldUtil, numIds);
+        }
+        sents.push_back(next);
+    }
+    delete io;
+    delete heldUtil;
+    unsigned best = 0;
+    for(unsigned g = 0; g < sweepResults_.size(); g++) {
+        swapSweepModels(g);
+        // the analysis depends on whether the solver is probabilistic
+        config_->setSolverType(sweepResults_[g].solver);
+        buildFeatureLookups();
+        testSweepModels(sents, sweepResults_[g]);
+        swapSweepModels(g);
+        if(sweepResults_[g].getScore() > sweepResults_[best].getScore())
+            best = g;
+    }
+    for(unsigned i = 0; i < sents.size(); i++)
+        delete sents[i];
+    // keep the classifiers of the best point
+    swapSweepModels(best);
+    for(unsigned i = 0; i < sweepMods_.size(); i++)
+        for(unsigned g = 1; g < sweepMods_[i].size(); g++)
+            delete sweepMods_[i][g];
+    sweepMods_.clear();
+    config_->setSolverType(sweepResults_[best].solver);
+    config_->setCost(sweepResults_[best].cost);
+    if(config_->getDebug() > 0) {
+        cerr << " solver     cost   time (s)    WS F-meas";
+        for(int lev = 0; lev < config_->getNumTags(); lev++)
+            cerr << "  tag " << lev+1 << " acc";
+        cerr << endl;
+        for(unsigned g = 0; g < sweepResults_.size(); g++) {
+            const SweepResult & res = sweepResults_[g];
+            cerr << setw(7) << res.solver << setw(9) << res.cost << fixed << setprecision(2) << setw(11) << res.time << setprecision(4);
+            if(res.wsFMeas >= 0) cerr << setw(13) << res.wsFMeas; else cerr << setw(13) << "-";
+            for(unsigned lev = 0; lev < res.tagAccs.size(); lev++)
+                if(res.tagAccs[lev] >= 0) cerr << setw(11) << res.tagAccs[lev]; else cerr << setw(11) << "-";
+            cerr << (g == best ? "  *" : "") << endl;
+            cerr.unsetf(ios::floatfield);
+            cerr << setprecision(6);
+        }
+    }
+}
+
 // train the analyzer
 void Kytea::trainAll() {
     
     // sanity check
     trainSanityCheck();
+
+    // make the settings of a hyperparameter sweep, which are all trained on
+    //  the same features
+    sweepResults_.clear();
+    if(config_->getSweeping()) {
+        vector<int> solvers = config_->getSweepSolvers();
+        vector<double> costs = config_->getSweepCosts();
+        if(solvers.size() == 0) solvers.push_back(config_->getSolverType());
+        if(costs.size() == 0) costs.push_back(config_->getCost());
+        for(unsigned i = 0; i < solvers.size(); i++)
+            for(unsigned j = 0; j < costs.size(); j++)
+                sweepResults_.push_back(SweepResult(solvers[i], costs[j]));
+    }
     
     // handle the feature files
     if(config_->getFeatureIn().length()) {
@@ -1109,7 +1549,7 @@ void Kytea::trainAll() {
     }
     config_->setNumTags(max(config_->getNumTags(),fio_->getNumTags()));
     if(config_->getFeatureOut().length())
-        fio_->openOut(config_->getFeatureOut());
+        fio_->openOut(config_->getFeatureOut(), config_->getFeatureBinary());
 
     // load the vocabulary, tags
     buildVocabulary();
@@ -1140,9 +1580,15 @@ void Kytea::trainAll() {
     // close the feature output
     fio_->closeOut();
 
+    // keep the most accurate models of the sweep
+    if(sweepResults_.size() > 0)
+        chooseSweepModels();
+
     // write the models out to a file
     writeModel(config_->getModelFile().c_str());
 
+    prepareAnalysis();
+
 }
 
 // load the models and analyze the input
@@ -1186,46 +1632,249 @@ void Kytea::analyze() {
     if(config_->getDebug() > 0)    
         cerr << "Analyzing input ";
 
+    // with several threads, the input and output each add characters to
+    //  their own copy of the StringUtil, while the model's is shared
+    const bool parallel = config_->getNumThreads() > 1;
+    StringUtil * inUtil = (parallel ? copyStringUtil(*util_) : util_);
+    StringUtil * outUtil = (parallel ? copyStringUtil(*util_) : util_);
     CorpusIO *in, *out;
     iostream *inStr = 0, *outStr = 0;
+    FileDescriptorBuf * inBuf = 0;
     const vector<string> & args = config_->getArguments();
     if(args.size() > 0) {
-        in  = CorpusIO::createIO(args[0].c_str(),config_->getInputFormat(), *config_, false, util_);
+        in  = CorpusIO::createIO(args[0].c_str(),config_->getInputFormat(), *config_, false, inUtil);
     } else {
-        inStr = new iostream(cin.rdbuf());
-        in  = CorpusIO::createIO(*inStr, config_->getInputFormat(), *config_, false, util_);
+        inBuf = new FileDescriptorBuf(0);
+        inStr = new iostream(inBuf);
+        in  = CorpusIO::createIO(*inStr, config_->getInputFormat(), *config_, false, inUtil);
     }
     if(args.size() > 1) {
-        out  = CorpusIO::createIO(args[1].c_str(),config_->getOutputFormat(), *config_, true, util_);
+        out  = CorpusIO::createIO(args[1].c_str(),config_->getOutputFormat(), *config_, true, outUtil);
     } else {
         outStr = new iostream(cout.rdbuf());
-        out = CorpusIO::createIO(*outStr, config_->getOutputFormat(), *config_, true, util_);
+        out = CorpusIO::createIO(*outStr, config_->getOutputFormat(), *config_, true, outUtil);
     }
     out->setUnkTag(config_->getUnkTag());
     out->setNumTags(config_->getNumTags());
     for(int i = 0; i < config_->getNumTags(); i++)
         out->setDoTag(i,config_->getDoTag(i));
+    // if the input is a file, nobody is waiting for each line of output
+    if(args.size() > 0 || inBuf->isRegularFile())
+        out->setFlushEach(false);
 
-    KyteaSentence* next;
-    while((next = in->readSentence()) != 0) {
-        if(config_->getDoWS())
-            calculateWS(*next);
-        if(config_->getDoTags())
-            for(int i = 0; i < config_->getNumTags(); i++)
-                if(config_->getDoTag(i))
-                    calculateTags(*next, i);
-        out->writeSentence(next);
-        delete next;
+    if(parallel) {
+        analyzeParallel(*in, *out, *inUtil, *outUtil);
+    } else {
+        KyteaSentence* next;
+        while((next = in->readSentence()) != 0) {
+            analyzeSentence(*next);
+            out->writeSentence(next);
+            delete next;
+        }
     }
 
     delete in;
     delete out;
     if(inStr) delete inStr;
+    if(inBuf) delete inBuf;
     if(outStr) delete outStr;
+    if(parallel) {
+        delete inUtil;
+        delete outUtil;
+    }
 
-    if(config_->getDebug() > 0)    
+    if(config_->getDebug() > 0) {
         cerr << "done!" << endl;
+        if(unkCache_)
+            cerr << "Unknown word cache: " << getUnkCacheHits() << " hits, "
+                 << getUnkCacheMisses() << " misses" << endl;
+    }
+
+}
+
+void Kytea::analyzeSentence(KyteaSentence & sent) const {
+    AnalysisScratch::get().reset();
+    if(config_->getDoWS())
+        calculateWS(sent);
+    if(config_->getDoTags())
+        for(int i = 0; i < config_->getNumTags(); i++)
+            if(config_->getDoTag(i))
+                calculateTags(sent, i);
+}
+
+// A sentence in the queue of analyzeParallel, and the characters that
+//  were added to the StringUtil of the input while reading it
+class ParallelJob {
+public:
+    KyteaSentence * sent;
+    std::vector<std::string> newChars;
+    bool done;
+    ParallelJob() : sent(0), done(false) { }
+};
+
+// Map the characters of str that were added to the StringUtil of the input
+//  (ids numIds and above) to their ids in the StringUtil of the output
+static void mapOutputChars(KyteaString & str, const std::vector<KyteaChar> & outIds, unsigned numIds) {
+    for(unsigned i = 0; i < str.length(); i++)
+        if(str[i] >= numIds && str[i] - numIds < outIds.size())
+            str[i] = outIds[str[i] - numIds];
+}
+
+// The input is read by a reader thread, analyzed by a pool of worker
+// threads, and written in its original order by the calling thread, with
+// at most numThreads*256 sentences between the reader and the writer.
+// Reading and writing may add characters to a StringUtil, so the reader
+// and writer each have their own copy of the model's StringUtil, while the
+// workers only read the model. The normalized strings that the workers
+// analyze are mapped to the model's ids, and the surface strings are
+// mapped from the ids of the input to those of the output before writing,
+// so the output is identical to that of the single-threaded analysis.
+void Kytea::analyzeParallel(CorpusIO & in, CorpusIO & out, const StringUtil & inUtil, StringUtil & outUtil) {
+    const unsigned numThreads = config_->getNumThreads();
+    const unsigned capacity = numThreads * 256;
+    const unsigned numIds = util_->getNumCharIds();
+    std::vector<ParallelJob> jobs(capacity);
+    std::deque<unsigned> work;
+    unsigned numRead = 0, numWritten = 0;
+    bool readDone = false, failed = false;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable readCond, workCond, writeCond;
+    // must be called while holding the lock
+    auto fail = [&]() {
+        if(!error) error = std::current_exception();
+        failed = true;
+        readCond.notify_all();
+        workCond.notify_all();
+        writeCond.notify_all();
+    };
+    // the characters that were added to the input's StringUtil before the
+    //  analysis started (by the CorpusIO itself)
+    std::vector<KyteaChar> outIds;
+    for(unsigned c = numIds; c < inUtil.getNumCharIds(); c++)
+        outIds.push_back(outUtil.mapChar(inUtil.showChar(c)));
+    // reader stage
+    std::thread reader([&]() {
+        try {
+            KyteaSentence * next;
+            while(true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    readCond.wait(lock, [&]() { return failed || numRead - numWritten < capacity; });
+                    if(failed) return;
+                }
+                // the slot of numRead is not used by the workers or writer
+                ParallelJob & job = jobs[numRead % capacity];
+                const unsigned before = inUtil.getNumCharIds();
+                if((next = in.readSentence()) == 0)
+                    break;
+                job.sent = next;
+                job.done = false;
+                job.newChars.clear();
+                for(unsigned c = before; c < inUtil.getNumCharIds(); c++)
+                    job.newChars.push_back(inUtil.showChar(c));
+                mapUnseenChars(next->norm, *util_, inUtil, numIds);
+                for(unsigned i = 0; i < next->words.size(); i++)
+                    mapUnseenChars(next->words[i].norm, *util_, inUtil, numIds);
+                std::lock_guard<std::mutex> lock(mutex);
+                work.push_back(numRead++);
+                workCond.notify_one();
+            }
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            fail();
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        readDone = true;
+        workCond.notify_all();
+        writeCond.notify_all();
+    });
+    // worker stage
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < numThreads; i++) {
+        workers.push_back(std::thread([&]() {
+            while(true) {
+                unsigned id;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    workCond.wait(lock, [&]() { return failed || work.size() > 0 || readDone; });
+                    if(failed || work.size() == 0)
+                        return;
+                    id = work.front();
+                    work.pop_front();
+                }
+                try {
+                    analyzeSentence(*jobs[id % capacity].sent);
+                } catch(...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    fail();
+                    return;
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs[id % capacity].done = true;
+                if(id == numWritten)
+                    writeCond.notify_one();
+            }
+        }));
+    }
+    // writer stage
+    try {
+        while(true) {
+            ParallelJob * job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                writeCond.wait(lock, [&]() {
+                    return failed
+                        || (numWritten < numRead && jobs[numWritten % capacity].done)
+                        || (readDone && numWritten == numRead); });
+                if(failed || numWritten == numRead)
+                    break;
+                job = &jobs[numWritten % capacity];
+            }
+            for(unsigned i = 0; i < job->newChars.size(); i++)
+                outIds.push_back(outUtil.mapChar(job->newChars[i]));
+            KyteaSentence & sent = *job->sent;
+            mapOutputChars(sent.surface, outIds, numIds);
+            for(unsigned i = 0; i < sent.words.size(); i++) {
+                KyteaWord & word = sent.words[i];
+                mapOutputChars(word.surface, outIds, numIds);
+                for(unsigned lev = 0; lev < word.tags.size(); lev++)
+                    for(unsigned j = 0; j < word.tags[lev].size(); j++)
+                        mapOutputChars(word.tags[lev][j].first, outIds, numIds);
+            }
+            out.writeSentence(job->sent);
+            delete job->sent;
+            job->sent = 0;
+            std::lock_guard<std::mutex> lock(mutex);
+            numWritten++;
+            readCond.notify_one();
+        }
+    } catch(...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        fail();
+    }
+    reader.join();
+    for(unsigned i = 0; i < workers.size(); i++)
+        workers[i].join();
+    for(unsigned id = numWritten; id < numRead; id++)
+        delete jobs[id % capacity].sent;
+    if(error)
+        std::rethrow_exception(error);
+}
+
+void Kytea::prepareAnalysis() {
+    util_->mapString(config_->getDefaultTag());
+    util_->mapString("<NULL>");
+    util_->freeze();
+    // the cached tags may have come from a different model
+    setUnkCacheSize(config_->getUnkCacheSize());
+}
 
+void Kytea::setUnkCacheSize(unsigned size) {
+    config_->setUnkCacheSize(size);
+    if(unkCache_) delete unkCache_;
+    unkCache_ = (size > 0 ? new UnkTagCache(size) : 0);
 }
 
 void Kytea::checkEqual(const Kytea & rhs) {
@@ -1247,6 +1896,7 @@ Kytea::~Kytea() {
     if(wsModel_) delete wsModel_;
     if(config_) delete config_;
     if(fio_) delete fio_;
+    if(unkCache_) delete unkCache_;
     for(int i = 0; i < (int)subwordModels_.size(); i++) {
         if(subwordModels_[i] != 0) delete subwordModels_[i];
     }
@@ -1254,6 +1904,9 @@ Kytea::~Kytea() {
         if(globalMods_[i] != 0) delete globalMods_[i];
     for(Sentences::iterator it = sentences_.begin(); it != sentences_.end(); it++)
         delete *it;
+    for(unsigned i = 0; i < sweepMods_.size(); i++)
+        for(unsigned g = 1; g < sweepMods_[i].size(); g++)
+            delete sweepMods_[i][g];
     
 }
 void Kytea::init() { 
@@ -1263,6 +1916,8 @@ void Kytea::init() {
     wsModel_ = NULL;
     subwordDict_ = NULL;
     fio_ = new FeatureIO;
+    unkCache_ = NULL;
+    corpusTags_ = 0;
 }
 
 template <class Entry>
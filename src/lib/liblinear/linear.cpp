@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <thread>
+#include <atomic>
+#include <vector>
 #include "linear.h"
 #include "tron.h"
 typedef signed char schar;
@@ -21,6 +24,102 @@ template <class S, class T> static inline void clone(T*& dst, S* src, int n)
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 #define INF HUGE_VAL
 
+// Call func(begin, end) for blocks of block indices that cover [0, n), on up
+// to nr_thread threads, each of which takes the next block when it is free.
+// Callers only use this for work whose result does not depend on how it is
+// divided, so the models are the same for any number of threads.
+template <class Func>
+static void parallel_for(int nr_thread, int n, int block, Func func)
+{
+	if(nr_thread <= 1 || n <= block)
+	{
+		func(0, n);
+		return;
+	}
+	std::atomic<int> next(0);
+	auto worker = [&]() {
+		int begin;
+		while((begin = next.fetch_add(block)) < n)
+			func(begin, min(begin+block, n));
+	};
+	std::vector<std::thread> threads;
+	for(int i = 1; i < nr_thread && i*block < n; i++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for(size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+// The rows that each thread takes at once in the matrix-vector products
+#define PARALLEL_ROWS 1024
+
+// The columns of the data, with the rows of each column in increasing
+// order. The products with the transpose of the data are found column by
+// column on several threads, adding the values in the same order as the
+// loop over the rows, so the sums are exactly the same.
+class column_index
+{
+public:
+	column_index(const problem *prob, int w_size)
+	{
+		int i;
+		start.assign(w_size+1, 0);
+		for(i=0;i<prob->l;i++)
+			for(feature_node *s=prob->x[i]; s->index!=-1; s++)
+				start[s->index]++;
+		for(i=0;i<w_size;i++)
+			start[i+1] += start[i];
+		row.resize(start[w_size]);
+		value.resize(start[w_size]);
+		std::vector<int> pos(start.begin(), start.end()-1);
+		for(i=0;i<prob->l;i++)
+			for(feature_node *s=prob->x[i]; s->index!=-1; s++)
+			{
+				row[pos[s->index-1]] = i;
+				value[pos[s->index-1]++] = s->value;
+			}
+	}
+
+	// XTv[j] = sum of v[pos[i]]*x_ij over the rows i with pos[i] >= 0 (or
+	// over all rows if pos is NULL)
+	void XTv(int nr_thread, const double *v, const int *pos, double *XTv) const
+	{
+		parallel_for(nr_thread, (int)start.size()-1, PARALLEL_ROWS, [&](int begin, int end) {
+			for(int j=begin;j<end;j++)
+			{
+				double sum = 0;
+				for(int k=start[j];k<start[j+1];k++)
+				{
+					if(pos == NULL)
+						sum += v[row[k]]*value[k];
+					else if(pos[row[k]] >= 0)
+						sum += v[pos[row[k]]]*value[k];
+				}
+				XTv[j] = sum;
+			}
+		});
+	}
+
+private:
+	std::vector<int> start, row;
+	std::vector<double> value;
+};
+
+// The random order of the coordinate descent solvers. Each thread has its
+// own generator, which is reset whenever a model starts training, so the
+// model does not depend on which thread trains it or on what was trained
+// before it.
+static thread_local unsigned long long rand_state = 1;
+static inline void reset_rand()
+{
+	rand_state = 1;
+}
+static inline int next_rand()
+{
+	rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (int)(rand_state >> 33);
+}
+
 static void print_string_stdout(const char *s)
 {
 	fputs(s,stdout);
@@ -46,7 +145,7 @@ static void info(const char *fmt,...) {}
 class l2r_lr_fun : public function
 {
 public:
-	l2r_lr_fun(const problem *prob, double Cp, double Cn);
+	l2r_lr_fun(const problem *prob, double Cp, double Cn, int nr_thread);
 	~l2r_lr_fun();
 
 	double fun(double *w);
@@ -63,15 +162,19 @@ private:
 	double *z;
 	double *D;
 	const problem *prob;
+	int nr_thread;
+	column_index *columns;
 };
 
-l2r_lr_fun::l2r_lr_fun(const problem *prob, double Cp, double Cn)
+l2r_lr_fun::l2r_lr_fun(const problem *prob, double Cp, double Cn, int nr_thread)
 {
 	int i;
 	int l=prob->l;
 	int *y=prob->y;
 
 	this->prob = prob;
+	this->nr_thread = nr_thread;
+	columns = (nr_thread > 1 ? new column_index(prob, prob->n) : NULL);
 
 	z = new double[l];
 	D = new double[l];
@@ -91,6 +194,7 @@ l2r_lr_fun::~l2r_lr_fun()
 	delete[] z;
 	delete[] D;
 	delete[] C;
+	delete columns;
 }
 
 
@@ -162,20 +266,20 @@ void l2r_lr_fun::Hv(double *s, double *Hs)
 
 void l2r_lr_fun::Xv(double *v, double *Xv)
 {
-	int i;
-	int l=prob->l;
 	feature_node **x=prob->x;
 
-	for(i=0;i<l;i++)
-	{
-		feature_node *s=x[i];
-		Xv[i]=0;
-		while(s->index!=-1)
+	parallel_for(nr_thread, prob->l, PARALLEL_ROWS, [&](int begin, int end) {
+		for(int i=begin;i<end;i++)
 		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
+			feature_node *s=x[i];
+			Xv[i]=0;
+			while(s->index!=-1)
+			{
+				Xv[i]+=v[s->index-1]*s->value;
+				s++;
+			}
 		}
-	}
+	});
 }
 
 void l2r_lr_fun::XTv(double *v, double *XTv)
@@ -185,6 +289,12 @@ void l2r_lr_fun::XTv(double *v, double *XTv)
 	int w_size=get_nr_variable();
 	feature_node **x=prob->x;
 
+	if(columns)
+	{
+		columns->XTv(nr_thread, v, NULL, XTv);
+		return;
+	}
+
 	for(i=0;i<w_size;i++)
 		XTv[i]=0;
 	for(i=0;i<l;i++)
@@ -201,7 +311,7 @@ void l2r_lr_fun::XTv(double *v, double *XTv)
 class l2r_l2_svc_fun : public function
 {
 public:
-	l2r_l2_svc_fun(const problem *prob, double Cp, double Cn);
+	l2r_l2_svc_fun(const problem *prob, double Cp, double Cn, int nr_thread);
 	~l2r_l2_svc_fun();
 
 	double fun(double *w);
@@ -221,15 +331,22 @@ private:
 	int *I;
 	int sizeI;
 	const problem *prob;
+	int nr_thread;
+	column_index *columns;
+	// the position of each row in I, or -1 if it is not there
+	int *posI;
 };
 
-l2r_l2_svc_fun::l2r_l2_svc_fun(const problem *prob, double Cp, double Cn)
+l2r_l2_svc_fun::l2r_l2_svc_fun(const problem *prob, double Cp, double Cn, int nr_thread)
 {
 	int i;
 	int l=prob->l;
 	int *y=prob->y;
 
 	this->prob = prob;
+	this->nr_thread = nr_thread;
+	columns = (nr_thread > 1 ? new column_index(prob, prob->n) : NULL);
+	posI = (nr_thread > 1 ? new int[l] : NULL);
 
 	z = new double[l];
 	D = new double[l];
@@ -251,6 +368,8 @@ l2r_l2_svc_fun::~l2r_l2_svc_fun()
 	delete[] D;
 	delete[] C;
 	delete[] I;
+	delete columns;
+	delete[] posI;
 }
 
 double l2r_l2_svc_fun::fun(double *w)
@@ -322,37 +441,38 @@ void l2r_l2_svc_fun::Hv(double *s, double *Hs)
 
 void l2r_l2_svc_fun::Xv(double *v, double *Xv)
 {
-	int i;
-	int l=prob->l;
 	feature_node **x=prob->x;
 
-	for(i=0;i<l;i++)
-	{
-		feature_node *s=x[i];
-		Xv[i]=0;
-		while(s->index!=-1)
+	parallel_for(nr_thread, prob->l, PARALLEL_ROWS, [&](int begin, int end) {
+		for(int i=begin;i<end;i++)
 		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
+			feature_node *s=x[i];
+			Xv[i]=0;
+			while(s->index!=-1)
+			{
+				Xv[i]+=v[s->index-1]*s->value;
+				s++;
+			}
 		}
-	}
+	});
 }
 
 void l2r_l2_svc_fun::subXv(double *v, double *Xv)
 {
-	int i;
 	feature_node **x=prob->x;
 
-	for(i=0;i<sizeI;i++)
-	{
-		feature_node *s=x[I[i]];
-		Xv[i]=0;
-		while(s->index!=-1)
+	parallel_for(nr_thread, sizeI, PARALLEL_ROWS, [&](int begin, int end) {
+		for(int i=begin;i<end;i++)
 		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
+			feature_node *s=x[I[i]];
+			Xv[i]=0;
+			while(s->index!=-1)
+			{
+				Xv[i]+=v[s->index-1]*s->value;
+				s++;
+			}
 		}
-	}
+	});
 }
 
 void l2r_l2_svc_fun::subXTv(double *v, double *XTv)
@@ -361,6 +481,16 @@ void l2r_l2_svc_fun::subXTv(double *v, double *XTv)
 	int w_size=get_nr_variable();
 	feature_node **x=prob->x;
 
+	if(columns)
+	{
+		for(i=0;i<prob->l;i++)
+			posI[i] = -1;
+		for(i=0;i<sizeI;i++)
+			posI[I[i]] = i;
+		columns->XTv(nr_thread, v, posI, XTv);
+		return;
+	}
+
 	for(i=0;i<w_size;i++)
 		XTv[i]=0;
 	for(i=0;i<sizeI;i++)
@@ -519,7 +649,7 @@ void Solver_MCSVM_CS::Solve(double *w)
 		double stopping = -INF;
 		for(i=0;i<active_size;i++)
 		{
-			int j = i+rand()%(active_size-i);
+			int j = i+next_rand()%(active_size-i);
 			swap(index[i], index[j]);
 		}
 		for(s=0;s<active_size;s++)
@@ -771,7 +901,7 @@ static void solve_l2r_l1l2_svc(
 
 		for (i=0; i<active_size; i++)
 		{
-			int j = i+rand()%(active_size-i);
+			int j = i+next_rand()%(active_size-i);
 			swap(index[i], index[j]);
 		}
 
@@ -954,7 +1084,7 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 	{
 		for (i=0; i<l; i++)
 		{
-			int j = i+rand()%(l-i);
+			int j = i+next_rand()%(l-i);
 			swap(index[i], index[j]);
 		}
 		int newton_iter = 0;
@@ -1130,7 +1260,7 @@ static void solve_l1r_l2_svc(
 
 		for(j=0; j<active_size; j++)
 		{
-			int i = j+rand()%(active_size-j);
+			int i = j+next_rand()%(active_size-j);
 			swap(index[i], index[j]);
 		}
 
@@ -1424,7 +1554,7 @@ static void solve_l1r_lr(
 
 		for(j=0; j<active_size; j++)
 		{
-			int i = j+rand()%(active_size-j);
+			int i = j+next_rand()%(active_size-j);
 			swap(index[i], index[j]);
 		}
 
@@ -1740,6 +1870,7 @@ static void group_classes(const problem *prob, int *nr_class_ret, int **label_re
 
 static void train_one(const problem *prob, const parameter *param, double *w, double Cp, double Cn)
 {
+	reset_rand();
 	double eps=param->eps;
 	int pos = 0;
 	int neg = 0;
@@ -1753,7 +1884,7 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 	{
 		case L2R_LR:
 		{
-			fun_obj=new l2r_lr_fun(prob, Cp, Cn);
+			fun_obj=new l2r_lr_fun(prob, Cp, Cn, param->nr_thread);
 			TRON tron_obj(fun_obj, eps*min(pos,neg)/prob->l);
 			tron_obj.set_print_string(liblinear_print_string);
 			tron_obj.tron(w);
@@ -1762,7 +1893,7 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 		}
 		case L2R_L2LOSS_SVC:
 		{
-			fun_obj=new l2r_l2_svc_fun(prob, Cp, Cn);
+			fun_obj=new l2r_l2_svc_fun(prob, Cp, Cn, param->nr_thread);
 			TRON tron_obj(fun_obj, eps*min(pos,neg)/prob->l);
 			tron_obj.set_print_string(liblinear_print_string);
 			tron_obj.tron(w);
@@ -1876,6 +2007,7 @@ model* train(const problem *prob, const parameter *param)
 			for(j=start[i];j<start[i]+count[i];j++)
 				sub_prob.y[j] = i;
 		Solver_MCSVM_CS Solver(&sub_prob, nr_class, weighted_C, param->eps);
+		reset_rand();
 		Solver.Solve(model_->w);
 	}
 	else
@@ -1896,26 +2028,37 @@ model* train(const problem *prob, const parameter *param)
 		else
 		{
 			model_->w=Malloc(double, w_size*nr_class);
-			double *w=Malloc(double, w_size);
-			for(i=0;i<nr_class;i++)
-			{
-				int si = start[i];
-				int ei = si+count[i];
+			// the classes are trained on separate threads, and the threads
+			// that are left over are shared by the classes
+			int nr_thread = max(param->nr_thread, 1);
+			int class_thread = min(nr_thread, nr_class);
+			parameter class_param = *param;
+			class_param.nr_thread = nr_thread/class_thread;
+			parallel_for(class_thread, nr_class, 1, [&](int begin, int end) {
+				problem class_prob = sub_prob;
+				class_prob.y = Malloc(int, sub_prob.l);
+				double *w=Malloc(double, w_size);
+				for(int i=begin;i<end;i++)
+				{
+					int si = start[i];
+					int ei = si+count[i];
 
-				k=0;
-				for(; k<si; k++)
-					sub_prob.y[k] = -1;
-				for(; k<ei; k++)
-					sub_prob.y[k] = +1;
-				for(; k<sub_prob.l; k++)
-					sub_prob.y[k] = -1;
+					int k=0;
+					for(; k<si; k++)
+						class_prob.y[k] = -1;
+					for(; k<ei; k++)
+						class_prob.y[k] = +1;
+					for(; k<class_prob.l; k++)
+						class_prob.y[k] = -1;
 
-				train_one(&sub_prob, param, w, weighted_C[i], param->C);
+					train_one(&class_prob, &class_param, w, weighted_C[i], param->C);
 
-				for(int j=0;j<w_size;j++)
-					model_->w[j*nr_class+i] = w[j];
-			}
-			free(w);
+					for(int j=0;j<w_size;j++)
+						model_->w[j*nr_class+i] = w[j];
+				}
+				free(w);
+				free(class_prob.y);
+			});
 		}
 
 	}
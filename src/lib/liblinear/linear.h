@@ -5,10 +5,12 @@
 extern "C" {
 #endif
 
+/* The values are stored as floats to halve the size of the training data,
+   which only holds the values 1 and -1 */
 struct feature_node
 {
 	int index;
-	double value;
+	float value;
 };
 
 struct problem
@@ -31,6 +33,7 @@ struct parameter
 	int nr_weight;
 	int *weight_label;
 	double* weight;
+	int nr_thread;		/* threads to use for training (values below 1 mean 1) */
 };
 
 struct model
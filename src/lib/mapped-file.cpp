@@ -0,0 +1,71 @@
+/*
+* Copyright 2009, KyTea Development Team
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <kytea/config.h>
+#include <kytea/mapped-file.h>
+#include <kytea/kytea-util.h>
+#include <fstream>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace kytea {
+
+MappedFile::MappedFile(const char* fileName) : data_(0), size_(0), mapped_(false) {
+#ifdef HAVE_SYS_MMAN_H
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0)
+        THROW_ERROR("Couldn't open file '"<<fileName<<"' for input");
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        void * addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(addr != MAP_FAILED) {
+            data_ = (const char*)addr;
+            size_ = st.st_size;
+            mapped_ = true;
+        }
+    }
+    close(fd);
+    if(mapped_)
+        return;
+#endif
+    // If the file could not be mapped, read it into memory
+    ifstream ifs(fileName, ifstream::in | ifstream::binary);
+    if(!ifs.good())
+        THROW_ERROR("Couldn't open file '"<<fileName<<"' for input");
+    ifs.seekg(0, ifstream::end);
+    buffer_.resize((size_t)ifs.tellg());
+    ifs.seekg(0, ifstream::beg);
+    if(buffer_.size() > 0 && !ifs.read(&buffer_[0], buffer_.size()))
+        THROW_ERROR("Couldn't read file '"<<fileName<<"'");
+    data_ = (buffer_.size() ? &buffer_[0] : 0);
+    size_ = buffer_.size();
+}
+
+MappedFile::~MappedFile() {
+#ifdef HAVE_SYS_MMAN_H
+    if(mapped_)
+        munmap(const_cast<char*>(data_), size_);
+#endif
+}
+
+}
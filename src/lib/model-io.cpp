@@ -25,6 +25,7 @@
 #include <kytea/model-io.h>
 #include <kytea/model-io-text.h>
 #include <kytea/model-io-binary.h>
+#include <kytea/model-io-mapped.h>
 #include <algorithm>
 #include <cstring>
 #include <set>
@@ -56,15 +57,17 @@ ModelIO * ModelIO::createIO(const char* file, Format form, bool output, KyteaCon
         if(!(iss >> buff1) || !(iss >> buff2) || !(iss >> buff3) || !(iss >> buff4) || 
                                   buff1 != "KyTea" || buff3.length() != 1)
             THROW_ERROR("Badly formed model (header incorrect)");
-        if(buff2 != MODEL_IO_VERSION)
-            THROW_ERROR("Incompatible model version. Expected " << MODEL_IO_VERSION << ", but found " << buff2 << ".");
         form = buff3[0];
+        const char * version = (form == ModelIO::FORMAT_MAPPED ? MODEL_IO_MAPPED_VERSION : MODEL_IO_VERSION);
+        if(buff2 != version)
+            THROW_ERROR("Incompatible model version. Expected " << version << ", but found " << buff2 << ".");
         config.setEncoding(buff4.c_str());
         ifs.close();
     }
     StringUtil * util = config.getStringUtil();
     if(form == ModelIO::FORMAT_TEXT)      { return new TextModelIO(util,file,output); }
     else if(form == ModelIO::FORMAT_BINARY) { return new BinaryModelIO(util,file,output); }
+    else if(form == ModelIO::FORMAT_MAPPED) { return new MappedModelIO(util,file,output); }
     else {
         THROW_ERROR("Illegal model format");
     }
@@ -74,6 +77,7 @@ ModelIO * ModelIO::createIO(iostream & file, Format form, bool output, KyteaConf
     StringUtil * util = config.getStringUtil();
     if(form == ModelIO::FORMAT_TEXT)      { return new TextModelIO(util,file,output); }
     else if(form == ModelIO::FORMAT_BINARY) { return new BinaryModelIO(util,file,output); }
+    else if(form == ModelIO::FORMAT_MAPPED) { return new MappedModelIO(util,file,output); }
     else {
         THROW_ERROR("Illegal model format");
     }
@@ -377,6 +381,7 @@ KyteaLM * TextModelIO::readLM() {
         if(prob != NEG_INFINITY)
             lm->probs_.insert(pair<KyteaString,double>(kword,prob)); 
     }
+    lm->buildPackedTables();
 
     return lm;
 }
@@ -542,8 +547,12 @@ ProbTagEntry* TextModelIO::readEntry<ProbTagEntry>() {
 }
 
 
-void BinaryModelIO::writeConfig(const KyteaConfig & config) {
+void BinaryModelIO::writeHeader(const KyteaConfig & config) {
     *str_ << "KyTea " << MODEL_IO_VERSION << " B " << config.getEncodingString() << endl;
+}
+
+void BinaryModelIO::writeConfig(const KyteaConfig & config) {
+    writeHeader(config);
 
     writeBinary(config.getDoWS());
     writeBinary(config.getDoTags());
@@ -679,6 +688,7 @@ KyteaLM* BinaryModelIO::readLM() {
                 lm->fallbacks_.insert(pair<KyteaString,double>(str,fallback));
         }
     } 
+    lm->buildPackedTables();
 
     return lm;
 
@@ -844,4 +854,63 @@ FeatureLookup * BinaryModelIO::readFeatureLookup() {
     return look;
 }
 
+MappedModelIO::MappedModelIO(StringUtil* util, const char* file, bool out) :
+            BinaryModelIO(util), buf_(0), stream_(0) {
+    if(out) {
+        openFile(file, out, true);
+    } else {
+        mapping_.reset(new MappedFile(file));
+        buf_ = new MappedStreamBuf(mapping_->getData(), mapping_->getSize());
+        stream_ = new iostream(buf_);
+        setStream(*stream_, out, true);
+    }
+}
+
+MappedModelIO::MappedModelIO(StringUtil* util, iostream & str, bool out) :
+            BinaryModelIO(util), buf_(0), stream_(0) {
+    if(!out)
+        THROW_ERROR("Memory-mapped models can only be read from a file");
+    setStream(str, out, true);
+}
+
+MappedModelIO::~MappedModelIO() {
+    if(stream_) delete stream_;
+    if(buf_) delete buf_;
+}
+
+void MappedModelIO::writeHeader(const KyteaConfig & config) {
+    *str_ << "KyTea " << MODEL_IO_MAPPED_VERSION << " M " << config.getEncodingString() << endl;
+}
+
+void MappedModelIO::writeVectorDictionary(const Dictionary<FeatVec> * dict) {
+    if(!writeAutomaton(dict))
+        return;
+    // Write all entries in a single array with a fixed size for each entry
+    unsigned numEntries = dict->getNumEntries();
+    unsigned valueSize = (numEntries ? dict->getNumValues(0) : 0);
+    writeBinary((uint32_t)valueSize);
+    if(dict->getValueSize() != 0) {
+        writeArray(dict->getFlatValues());
+        return;
+    }
+    vector<FeatVal> values;
+    values.reserve(numEntries*valueSize);
+    for(unsigned i = 0; i < numEntries; i++) {
+        if(dict->getNumValues(i) != valueSize)
+            THROW_ERROR("All entries of a feature dictionary must be the same size ("<<dict->getNumValues(i)<<" != "<<valueSize<<")");
+        const FeatVal * vals = dict->getValues(i);
+        values.insert(values.end(), vals, vals+valueSize);
+    }
+    writeArray(values.size() ? &values[0] : (FeatVal*)0, values.size());
+}
+
+Dictionary<FeatVec> * MappedModelIO::readVectorDictionary() {
+    Dictionary<FeatVec> * dict = readAutomaton<FeatVec>();
+    if(dict == 0)
+        return 0;
+    dict->setValueSize(readBinary<uint32_t>());
+    readArray(dict->getFlatValues());
+    return dict;
+}
+
 }
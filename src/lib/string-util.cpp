@@ -20,8 +20,11 @@
 #include <kytea/string-util-map-euc.h>
 #include <kytea/string-util-map-sjis.h>
 #include <cstdlib>
+#include <cstring>
+#include <stdint.h>
 #include <iostream>
 #include <limits>
+#include <atomic>
 
 using namespace kytea;
 using namespace std;
@@ -39,6 +42,11 @@ void StringUtil::checkEqual(const StringUtil & rhs) const {
 }
 
 // parse an integer or float
+unsigned long StringUtil::nextSerial() {
+    static atomic<unsigned long> serial(0);
+    return ++serial;
+}
+
 int StringUtil::parseInt(const char* str) const {
     char* endP;
     int ret = strtol(str, &endP, 10);
@@ -54,12 +62,13 @@ double StringUtil::parseFloat(const char* str) const {
     return ret;
 }
 
-StringUtilUtf8::StringUtilUtf8() {
+StringUtilUtf8::StringUtilUtf8() : bmpIds_(0x10000, 0) {
     const char * initial[7] = { "", "K", "T", "H", "R", "D", "O" };
     for(unsigned i = 0; i < 7; i++) {
         charIds_.insert(std::pair<std::string,KyteaChar>(initial[i], i));
         charTypes_.push_back(i==0?6:4); // first is other, rest romaji
         charNames_.push_back(initial[i]);
+        addCodePoint(initial[i], i);
     }
 }
 
@@ -109,6 +118,12 @@ GenericMap<KyteaChar,KyteaChar> * StringUtilEuc::getNormMap() {
 }
 
 
+// the character types in the order of the reserved unknown ids
+static const char utf8UnknownTypes[] = { 
+    StringUtil::KANJI, StringUtil::KATAKANA, StringUtil::HIRAGANA,
+    StringUtil::ROMAJI, StringUtil::DIGIT, StringUtil::OTHER 
+};
+
 // map a string to a character
 KyteaChar StringUtilUtf8::mapChar(const string & str, bool add) {
     StringCharMap::iterator it = charIds_.find(str);
@@ -116,65 +131,159 @@ KyteaChar StringUtilUtf8::mapChar(const string & str, bool add) {
     if(it != charIds_.end())
         ret = it->second;
     else if (add) {
-        if (charTypes_.size() > std::numeric_limits<KyteaChar>::max())
+        if (charTypes_.size() >= UNKNOWN_BASE)
           THROW_ERROR("FATAL ERROR: id exceeds numerical limit in string-util.cpp : StringUtilUtf8");
         ret = charTypes_.size();
         charIds_.insert(pair<string, KyteaChar>(str,ret));
         charTypes_.push_back(findType(str));
         charNames_.push_back(str);
+        addCodePoint(str, ret);
     }
     return ret;
 }
 
+// map a string to a character, or to the reserved id for its type
+KyteaChar StringUtilUtf8::mapChar(const string & str) const {
+    StringCharMap::const_iterator it = charIds_.find(str);
+    if(it != charIds_.end())
+        return it->second;
+    const CharType type = findType(str);
+    KyteaChar ret = UNKNOWN_BASE;
+    while(utf8UnknownTypes[ret-UNKNOWN_BASE] != type)
+        ret++;
+    return ret;
+}
+
 string StringUtilUtf8::showChar(KyteaChar c) const {
-#ifdef KYTEA_SAFE
-    if(c >= charNames_.size())
-        THROW_ERROR("FATAL: Index out of bounds in showChar");
-#endif 
+    // reserved ids, and characters that were added to a copy of this
+    //  StringUtil while analyzing with several threads
+    if(c >= UNKNOWN_BASE || c >= charNames_.size())
+        return "\xEF\xBF\xBD";
     return charNames_[c];
 }
+void StringUtilUtf8::appendChar(KyteaChar c, string & buff) const {
+    if(c >= UNKNOWN_BASE || c >= charNames_.size()) {
+        buff += "\xEF\xBF\xBD";
+        return;
+    }
+    buff += charNames_[c];
+}
 
 StringUtil::CharType StringUtilUtf8::findType(KyteaChar c) const {
+    if(c >= UNKNOWN_BASE)
+        return utf8UnknownTypes[c-UNKNOWN_BASE];
     return charTypes_[c];
 }
 
-KyteaString StringUtilUtf8::mapString(const string & str) {
-    unsigned pos = 0, len = str.length();
-    vector<KyteaChar> ret;
+// Get the code point of a character of len bytes. This fails if the
+// character is not encoded in the shortest form.
+inline bool utf8CodePoint(const unsigned char * s, unsigned len, unsigned & cp) {
+    switch(len) {
+        case 1:
+            cp = s[0];
+            return true;
+        case 2:
+            cp = ((s[0]&0x1F)<<6) | (s[1]&0x3F);
+            return (s[0]&0xE0) == 0xC0 && cp >= 0x80;
+        case 3:
+            cp = ((s[0]&0x0F)<<12) | ((s[1]&0x3F)<<6) | (s[2]&0x3F);
+            return cp >= 0x800;
+        case 4:
+            cp = ((s[0]&0x07)<<18) | ((s[1]&0x3F)<<12) | ((s[2]&0x3F)<<6) | (s[3]&0x3F);
+            return cp >= 0x10000;
+    }
+    return false;
+}
+
+void StringUtilUtf8::addCodePoint(const string & str, KyteaChar id) {
+    unsigned cp;
+    if(!utf8CodePoint((const unsigned char*)str.data(), str.length(), cp))
+        return;
+    if(cp < 0x10000)
+        bmpIds_[cp] = id;
+    else
+        suppIds_[cp] = id;
+}
+
+template <class Util>
+KyteaString StringUtilUtf8::mapUtf8String(Util & util, const char * str, size_t len) {
+    const unsigned char * s = (const unsigned char*)str;
+    // the characters are decoded into a buffer that is kept between calls,
+    // so only the returned string is allocated
+    static thread_local vector<KyteaChar> buff;
+    if(buff.size() < len)
+        buff.resize(len);
+    KyteaChar * ret = (len ? &buff[0] : 0);
+    const KyteaChar * ascii = &util.bmpIds_[0];
+    unsigned pos = 0, num = 0;
     while(pos < len) {
-        // single character unicode values
-        if(!(maskl1 & str[pos]))
-            ret.push_back(mapChar(str.substr(pos++, 1)));
-        else if((maskl5 & str[pos]) == maskl5) {
-            THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<str);
+        // map runs of ASCII eight bytes at a time
+        while(pos + 8 <= len) {
+            uint64_t block;
+            memcpy(&block, s+pos, 8);
+            if(block & 0x8080808080808080ULL)
+                break;
+            unsigned i = 0;
+            for( ; i < 8 && ascii[s[pos+i]]; i++)
+                ret[num++] = ascii[s[pos+i]];
+            pos += i;
+            if(i < 8)
+                break;
         }
-        else if((maskl4 & str[pos]) == maskl4) {
-            if(pos + 3 >= len || badu(str[pos+1]) || badu(str[pos+2]) || badu(str[pos+3]))
-                THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<str);
-            ret.push_back(mapChar(str.substr(pos, 4)));
-            pos += 4;
+        if(pos >= len)
+            break;
+        unsigned charLen;
+        if(!(maskl1 & s[pos]))
+            charLen = 1;
+        else if((maskl5 & s[pos]) == (unsigned char)maskl5) {
+            THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<string(str, len));
         }
-        else if((maskl3 & str[pos]) == maskl3) {
-            if(pos + 2 >= len || badu(str[pos+1]) || badu(str[pos+2]))
-                THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<str);
-            ret.push_back(mapChar(str.substr(pos, 3)));
-            pos += 3;
+        else if((maskl4 & s[pos]) == (unsigned char)maskl4) {
+            if(pos + 3 >= len || badu(s[pos+1]) || badu(s[pos+2]) || badu(s[pos+3]))
+                THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<string(str, len));
+            charLen = 4;
+        }
+        else if((maskl3 & s[pos]) == (unsigned char)maskl3) {
+            if(pos + 2 >= len || badu(s[pos+1]) || badu(s[pos+2]))
+                THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<string(str, len));
+            charLen = 3;
         }
         else {
-            if(pos + 1 >= len || badu(str[pos+1]))
-                THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<str);
-            ret.push_back(mapChar(str.substr(pos, 2)));
-            pos += 2;
+            if(pos + 1 >= len || badu(s[pos+1]))
+                THROW_ERROR("Expected UTF8 file but found non-UTF8 string (specify the proper encoding with -encode utf8/euc/sjis): "<<string(str, len));
+            charLen = 2;
         }
+        unsigned cp;
+        KyteaChar id = 0;
+        if(utf8CodePoint(s+pos, charLen, cp))
+            id = util.findCodePoint(cp);
+        // characters without an id are found or added by their bytes
+        if(id == 0)
+            id = util.mapChar(string(str+pos, charLen));
+        ret[num++] = id;
+        pos += charLen;
     }
-    KyteaString retstr(ret.size());
-    for(unsigned i = 0; i < ret.size(); i++)
-        retstr[i] = ret[i];
+    KyteaString retstr(num);
+    if(num)
+        memcpy(getChars(retstr), ret, sizeof(KyteaChar)*num);
     return retstr;
 }
 
+KyteaString StringUtilUtf8::mapString(const string & str) {
+    return mapUtf8String(*this, str.data(), str.length());
+}
+KyteaString StringUtilUtf8::mapString(const string & str) const {
+    return mapUtf8String(*this, str.data(), str.length());
+}
+KyteaString StringUtilUtf8::mapString(const char * str, size_t len) {
+    return mapUtf8String(*this, str, len);
+}
+KyteaString StringUtilUtf8::mapString(const char * str, size_t len) const {
+    return mapUtf8String(*this, str, len);
+}
+
 // find the type of a unicode character
-StringUtil::CharType StringUtilUtf8::findType(const string & str) {
+StringUtil::CharType StringUtilUtf8::findType(const string & str) const {
     // find the type of a unicode character
     if(str.length() == 0)
         return OTHER;
@@ -222,6 +331,8 @@ StringUtil::CharType StringUtilUtf8::findType(const string & str) {
 
 void StringUtilUtf8::unserialize(const string & str) {
     charIds_.clear(); charNames_.clear(); charTypes_.clear();
+    charTypeChars_.clear(); typeChars_.clear();
+    bmpIds_.assign(0x10000, 0); suppIds_.clear();
     mapChar("");
     KyteaString ret = mapString(str);
 }
@@ -247,6 +358,9 @@ inline unsigned char euc2(KyteaChar a) {
 }
 
 KyteaChar StringUtilEuc::mapChar(const string & str, bool add) {
+    return static_cast<const StringUtilEuc*>(this)->mapChar(str);
+}
+KyteaChar StringUtilEuc::mapChar(const string & str) const {
     unsigned len = str.length();
     KyteaChar ret;
     if(len == 1) {
@@ -280,9 +394,22 @@ string StringUtilEuc::showChar(KyteaChar c) const {
         return ret;
     }
 }
+// this stops at a zero byte in the same way as showChar
+void StringUtilEuc::appendChar(KyteaChar c, string & buff) const {
+    char arr[2] = { static_cast<char>(c), 0 };
+    if(c >= 0x8E) {
+        arr[0] = static_cast<char>(euc1(c));
+        arr[1] = static_cast<char>(euc2(c));
+    }
+    for(unsigned i = 0; i < 2 && arr[i]; i++)
+        buff += arr[i];
+}
 
 // map an unparsed string to a KyteaString
 KyteaString StringUtilEuc::mapString(const string & str) {
+    return static_cast<const StringUtilEuc*>(this)->mapString(str);
+}
+KyteaString StringUtilEuc::mapString(const string & str) const {
     unsigned pos = 0, len = str.length();
     vector<KyteaChar> ret;
     while(pos < len) {
@@ -301,7 +428,7 @@ KyteaString StringUtilEuc::mapString(const string & str) {
 }
 
 // get the type of a character
-StringUtil::CharType StringUtilEuc::findType(const string & str) {
+StringUtil::CharType StringUtilEuc::findType(const string & str) const {
     return findType(mapChar(str));
 }
 StringUtil::CharType StringUtilEuc::findType(KyteaChar c) const {
@@ -355,6 +482,9 @@ inline unsigned char sjis2(KyteaChar a) {
 }
 
 KyteaChar StringUtilSjis::mapChar(const string & str, bool add) {
+    return static_cast<const StringUtilSjis*>(this)->mapChar(str);
+}
+KyteaChar StringUtilSjis::mapChar(const string & str) const {
     unsigned len = str.length();
     KyteaChar ret;
     if(len == 1) {
@@ -390,9 +520,22 @@ string StringUtilSjis::showChar(KyteaChar c) const {
         return ret;
     }
 }
+// this stops at a zero byte in the same way as showChar
+void StringUtilSjis::appendChar(KyteaChar c, string & buff) const {
+    char arr[2] = { static_cast<char>(c), 0 };
+    if(c >= 0xFF) {
+        arr[0] = static_cast<char>(sjis1(c));
+        arr[1] = static_cast<char>(sjis2(c));
+    }
+    for(unsigned i = 0; i < 2 && arr[i]; i++)
+        buff += arr[i];
+}
 
 // map an unparsed string to a KyteaString
 KyteaString StringUtilSjis::mapString(const string & str) {
+    return static_cast<const StringUtilSjis*>(this)->mapString(str);
+}
+KyteaString StringUtilSjis::mapString(const string & str) const {
     unsigned pos = 0, len = str.length();
     vector<KyteaChar> ret;
     while(pos < len) {
@@ -412,7 +555,7 @@ KyteaString StringUtilSjis::mapString(const string & str) {
 }
 
 // get the type of a character
-StringUtil::CharType StringUtilSjis::findType(const string & str) {
+StringUtil::CharType StringUtilSjis::findType(const string & str) const {
     return findType(mapChar(str));
 }
 StringUtil::CharType StringUtilSjis::findType(KyteaChar c) const {
@@ -446,10 +589,44 @@ StringUtil::CharType StringUtilSjis::findType(KyteaChar c) const {
     return OTHER;
 }
 
+void StringUtil::buildTypeTable() {
+    // map each type through the const mapChar, so the result is the same as
+    // that of the const mapString, and the vocabulary does not grow
+    const StringUtil * constThis = this;
+    // (types are always ASCII characters)
+    typeChars_.assign(256, 0);
+    for(unsigned i = 0; i < 128; i++)
+        typeChars_[i] = constThis->mapChar(string(1, (char)i));
+    charTypeChars_.resize(getNumCharIds());
+    for(unsigned i = 0; i < charTypeChars_.size(); i++)
+        charTypeChars_[i] = typeChars_[(unsigned char)findType((KyteaChar)i)];
+}
+
+KyteaString StringUtil::getTypeKyteaString(const KyteaString & str) const {
+    if(typeChars_.empty())
+        return mapString(getTypeString(str));
+    KyteaString ret(str.length());
+    KyteaChar * chars = getChars(ret);
+    const KyteaChar * table = &charTypeChars_[0];
+    const unsigned tableSize = charTypeChars_.size();
+    for(unsigned i = 0; i < str.length(); i++) {
+        KyteaChar c = str[i];
+        // characters added after freeze() are not in the table
+        chars[i] = (c < tableSize ? table[c] : typeChars_[(unsigned char)findType(c)]);
+    }
+    return ret;
+}
+
 KyteaString StringUtil::normalize(const KyteaString & str) {
+    getNormMap();
+    return static_cast<const StringUtil*>(this)->normalize(str);
+}
+KyteaString StringUtil::normalize(const KyteaString & str) const {
     // std::cerr << showString(str) << std::endl;
+    if(normMap_ == NULL)
+        THROW_ERROR("The normalization map must be built with freeze() before normalizing with a const StringUtil");
     KyteaString ret(str.length());
-    GenericMap<KyteaChar,KyteaChar> * normMap = getNormMap();
+    const GenericMap<KyteaChar,KyteaChar> * normMap = normMap_;
     for(int i = 0; i < (int)str.length(); i++) {
         GenericMap<KyteaChar,KyteaChar>::const_iterator it = normMap->find(str[i]);
         ret[i] = (it == normMap->end()) ? str[i] : it->second;
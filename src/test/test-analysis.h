@@ -2,6 +2,9 @@
 #define TEST_ANALYSIS__
 
 #include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
 #include "test-base.h"
 
 namespace kytea {
@@ -360,6 +363,35 @@ public:
         } 
     }
 
+    int testTagsAfterConfidentWord() {
+        KyteaString str = util->mapString("これは学習データです。");
+        KyteaSentence expSent(str, util->normalize(str)), actSent(str, util->normalize(str));
+        kytea->calculateWS(expSent);
+        kytea->calculateTags(expSent,0);
+        // The dictionary entries are found during segmentation
+        kytea->calculateWS(actSent);
+        for(unsigned i = 0; i < actSent.words.size(); i++) {
+            if(actSent.words[i].entryDict == 0) {
+                cout << "Word "<<i<<" was not looked up during segmentation" << endl;
+                return 0;
+            }
+        }
+        // A word whose tag is already certain must not change the features
+        //  of the words after it
+        actSent.words[0].setTag(0, KyteaTag(util->mapString("X"), 100));
+        kytea->calculateTags(actSent,0);
+        int ok = 1;
+        for(unsigned i = 1; i < expSent.words.size(); i++) {
+            if(actSent.words[i].tags[0] != expSent.words[i].tags[0]) {
+                cout << "Tags of word "<<i<<" changed after a certain tag: "
+                     << util->showString(actSent.words[i].getTagSurf(0)) << " != "
+                     << util->showString(expSent.words[i].getTagSurf(0)) << endl;
+                ok = 0;
+            }
+        }
+        return ok;
+    }
+
     int testTextIO() {
         // Write the model
         kytea->getConfig()->setModelFormat(ModelIO::FORMAT_TEXT);
@@ -384,6 +416,355 @@ public:
         return 1;
     }
 
+    int testMappedIO() {
+        // Write the model
+        kytea->getConfig()->setModelFormat(ModelIO::FORMAT_MAPPED);
+        kytea->writeModel("/tmp/kytea-model.map");
+        kytea->getConfig()->setModelFormat(ModelIO::FORMAT_BINARY);
+        // Read the model
+        Kytea actKytea;
+        actKytea.readModel("/tmp/kytea-model.map");
+        // Check that they are equal and give the same analysis
+        kytea->checkEqual(actKytea);
+        const string text = "これはテストです。";
+        string exp = analyzeConst(kytea, text), act = analyzeConst(&actKytea, text);
+        if(exp != act) {
+            cout << "Mapped model analysis differs"<<endl<<" "<<exp<<endl<<" "<<act<<endl;
+            return 0;
+        }
+        return 1;
+    }
+
+    // Analyze a sentence using only the const functions
+    string analyzeConst(const Kytea * constKytea, const string & text) {
+        const StringUtil * constUtil = constKytea->getStringUtil();
+        KyteaString str = constUtil->mapString(text);
+        KyteaSentence sentence(str, constUtil->normalize(str));
+        constKytea->analyzeSentence(sentence);
+        ostringstream buff;
+        for(int i = 0; i < (int)sentence.words.size(); i++)
+            buff << constUtil->showString(sentence.words[i].surface) << "/"
+                 << constUtil->showString(sentence.words[i].getTagSurf(0)) << " ";
+        return buff.str();
+    }
+
+    int testConstAnalysis() {
+        const Kytea * constKytea = kytea;
+        const StringUtil * constUtil = constKytea->getStringUtil();
+        string before = constUtil->serialize();
+        // The unseen character must keep its type, and be shown as U+FFFD
+        KyteaString str = constUtil->mapString("鬱");
+        if(constUtil->findType(str[0]) != StringUtil::KANJI || constUtil->showString(str) != "\xEF\xBF\xBD") {
+            cerr << "Unseen character was not mapped to the reserved kanji" << endl;
+            return 0;
+        }
+        // Analyze the same sentence from several threads at once
+        const string text = "これは鬱データです。";
+        string exp = analyzeConst(constKytea, text);
+        vector<string> act(4);
+        vector<std::thread> threads;
+        for(int i = 0; i < (int)act.size(); i++)
+            threads.push_back(std::thread([&, i]() { act[i] = analyzeConst(constKytea, text); }));
+        for(int i = 0; i < (int)threads.size(); i++)
+            threads[i].join();
+        int ok = 1;
+        for(int i = 0; i < (int)act.size(); i++) {
+            if(act[i] != exp) {
+                cerr << "Thread "<<i<<" result '"<<act[i]<<"' != '"<<exp<<"'"<<endl;
+                ok = 0;
+            }
+        }
+        if(before != constUtil->serialize()) {
+            cerr << "The vocabulary was changed by const analysis" << endl;
+            ok = 0;
+        }
+        return ok;
+    }
+
+    string analyzeFile(const char* threads) {
+        const char* runCmd[7] = {"", "-model", "/tmp/kytea-svm-model.bin", "-threads", threads, "/tmp/kytea-parallel-in.txt", "/tmp/kytea-parallel-out.txt"};
+        KyteaConfig * config = new KyteaConfig;
+        config->setDebug(0);
+        config->setOnTraining(false);
+        config->parseRunCommandLine(7, runCmd);
+        Kytea runKytea(config);
+        runKytea.analyze();
+        ifstream ifs("/tmp/kytea-parallel-out.txt");
+        stringstream buff;
+        buff << ifs.rdbuf();
+        return buff.str();
+    }
+
+    int testParallelAnalysis() {
+        // Write an input with enough sentences to span several batches
+        const char* lines[4] = { "これは学習データです。", "京都に行った。", "", "東京でＫｙＴｅａを使ってください！" };
+        ofstream ofs("/tmp/kytea-parallel-in.txt");
+        for(int i = 0; i < 3000; i++)
+            ofs << lines[i % 4] << endl;
+        ofs.close();
+        // The output must not depend on the number of threads
+        string exp = analyzeFile("1");
+        string act = analyzeFile("4");
+        if(exp != act || exp.length() == 0) {
+            cerr << "Parallel output does not match the single-threaded output" << endl;
+            return 0;
+        }
+        return 1;
+    }
+
+    // Train a text model on the toy corpus and return its contents
+    string trainTextModel(const char * threads, const char * solver, const char * streamDir = 0) {
+        const char* cmd[12] = {"", "-model", "/tmp/kytea-threads-model.txt", "-modtext", "-full", "/tmp/kytea-toy-corpus.txt", "-solver", solver, "-threads", threads, "-stream", streamDir};
+        KyteaConfig * config = new KyteaConfig;
+        config->setDebug(0);
+        config->setOnTraining(true);
+        config->parseTrainCommandLine(streamDir ? 12 : 10, cmd);
+        Kytea threadKytea(config);
+        threadKytea.trainAll();
+        ifstream ifs("/tmp/kytea-threads-model.txt");
+        ostringstream buff;
+        buff << ifs.rdbuf();
+        return buff.str();
+    }
+
+    int testParallelTraining() {
+        // The models must not depend on the number of threads, also for the
+        //  solvers that visit the examples in a random order and the primal
+        //  solvers that divide the matrix products between the threads
+        const char* solvers[5] = { "0", "1", "2", "4", "7" };
+        int ok = 1;
+        for(int i = 0; i < 5; i++) {
+            string exp = trainTextModel("1", solvers[i]);
+            string act = trainTextModel("4", solvers[i]);
+            if(exp != act || exp.length() == 0) {
+                cerr << "Model trained with -solver "<<solvers[i]<<" depends on the number of threads" << endl;
+                ok = 0;
+            }
+        }
+        return ok;
+    }
+
+    int testStreamingTraining() {
+        // Reading the corpus again for each classifier must give the same
+        //  model as keeping it in memory. Files of other trainings in the
+        //  same directory must be left alone.
+        char dir[] = "/tmp/kytea-stream-XXXXXX";
+        if(!mkdtemp(dir)) {
+            cerr << "Could not make a directory for the test" << endl;
+            return 0;
+        }
+        const string other = string(dir)+"/kytea-ws.shard";
+        ofstream ofs(other.c_str()); ofs << "other" << endl; ofs.close();
+        string exp = trainTextModel("1", "1");
+        string act = trainTextModel("2", "1", dir);
+        int ok = 1;
+        if(exp != act || exp.length() == 0) {
+            cerr << "Model trained with -stream is different" << endl;
+            ok = 0;
+        }
+        ifstream ifs(other.c_str());
+        string line;
+        if(!getline(ifs, line) || line != "other") {
+            cerr << "Feature file of another training was changed" << endl;
+            ok = 0;
+        }
+        ifs.close();
+        remove(other.c_str());
+        // the directory can only be removed if it is empty
+        if(rmdir(dir) != 0) {
+            cerr << "Temporary feature files were not removed" << endl;
+            ok = 0;
+        }
+        return ok;
+    }
+
+    string trainFromFeatures(const char * featFile) {
+        const char* cmd[6] = {"", "-model", "/tmp/kytea-feat-model.txt", "-modtext", "-feat", featFile};
+        KyteaConfig * config = new KyteaConfig;
+        config->setDebug(0);
+        config->setOnTraining(true);
+        config->parseTrainCommandLine(6, cmd);
+        Kytea featKytea(config);
+        featKytea.trainAll();
+        ifstream ifs("/tmp/kytea-feat-model.txt");
+        ostringstream buff;
+        buff << ifs.rdbuf();
+        return buff.str();
+    }
+
+    int testBinaryFeatures() {
+        // Write the features in both formats, and check that the models
+        //  trained from them are the same
+        for(int bin = 0; bin < 2; bin++) {
+            const char* cmd[9] = {"", "-model", "/tmp/kytea-featout-model.bin", "-full", "/tmp/kytea-toy-corpus.txt", "-featout", (bin ? "/tmp/kytea-toy-feat.bin" : "/tmp/kytea-toy-feat.txt"), "-featbin"};
+            KyteaConfig * config = new KyteaConfig;
+            config->setDebug(0);
+            config->setOnTraining(true);
+            config->parseTrainCommandLine(7+bin, cmd);
+            Kytea featKytea(config);
+            featKytea.trainAll();
+        }
+        string exp = trainFromFeatures("/tmp/kytea-toy-feat.txt");
+        string act = trainFromFeatures("/tmp/kytea-toy-feat.bin");
+        if(exp != act || exp.length() == 0) {
+            cerr << "Models trained from text and binary features are different" << endl;
+            return 0;
+        }
+        return 1;
+    }
+
+    int testHyperparameterSweep() {
+        // Every setting is tested, and the model that is written must be
+        //  the same as one trained with the best setting alone, without the
+        //  characters that are only in the held-out corpus
+        ofstream held("/tmp/kytea-toy-heldout.txt");
+        held << "大阪/名詞/おおさか に/助詞/に 行/動詞/い っ/語尾/っ た/助動詞/た 。/補助記号/。" << endl
+             << "これ/代名詞/これ は/助詞/は データ/名詞/でーた で/助動詞/で す/語尾/す 。/補助記号/。" << endl;
+        held.close();
+        const char* cmd[14] = {"", "-model", "/tmp/kytea-sweep-model.txt", "-modtext", "-full", "/tmp/kytea-toy-corpus.txt", "-sweepcost", "0.01,1", "-sweepsolver", "7,1", "-heldout", "/tmp/kytea-toy-heldout.txt", "-threads", "3"};
+        KyteaConfig * config = new KyteaConfig;
+        config->setDebug(0);
+        config->setOnTraining(true);
+        config->parseTrainCommandLine(14, cmd);
+        Kytea sweepKytea(config);
+        sweepKytea.trainAll();
+        const vector<SweepResult> & results = sweepKytea.getSweepResults();
+        if(results.size() != 4 || results[0].solver != 7 || results[1].cost != 1) {
+            cerr << "Sweep made "<<results.size()<<" settings" << endl;
+            return 0;
+        }
+        unsigned best = 0;
+        for(unsigned i = 0; i < results.size(); i++) {
+            if(results[i].wsFMeas < 0 || results[i].tagAccs.size() != 2 || results[i].tagAccs[0] < 0) {
+                cerr << "Setting "<<i<<" was not tested" << endl;
+                return 0;
+            }
+            if(results[i].getScore() > results[best].getScore())
+                best = i;
+        }
+        if(config->getSolverType() != results[best].solver || config->getCost() != results[best].cost) {
+            cerr << "Chose solver "<<config->getSolverType()<<" and cost "<<config->getCost()<<", not setting "<<best<<endl;
+            return 0;
+        }
+        ostringstream solver, cost;
+        solver << results[best].solver;
+        cost << results[best].cost;
+        const char* bestCmd[10] = {"", "-model", "/tmp/kytea-best-model.txt", "-modtext", "-full", "/tmp/kytea-toy-corpus.txt", "-solver", solver.str().c_str(), "-cost", cost.str().c_str()};
+        KyteaConfig * bestConfig = new KyteaConfig;
+        bestConfig->setDebug(0);
+        bestConfig->setOnTraining(true);
+        bestConfig->parseTrainCommandLine(10, bestCmd);
+        Kytea bestKytea(bestConfig);
+        bestKytea.trainAll();
+        ifstream ifs1("/tmp/kytea-sweep-model.txt"), ifs2("/tmp/kytea-best-model.txt");
+        ostringstream exp, act;
+        exp << ifs2.rdbuf();
+        act << ifs1.rdbuf();
+        if(exp.str() != act.str() || exp.str().length() == 0) {
+            cerr << "Model chosen by the sweep is different from the best model" << endl;
+            return 0;
+        }
+        return 1;
+    }
+
+    string analyzeUnk(Kytea * unkKytea, const string & text) {
+        StringUtil * unkUtil = unkKytea->getStringUtil();
+        KyteaString str = unkUtil->mapString(text);
+        KyteaSentence sentence(str, unkUtil->normalize(str));
+        unkKytea->analyzeSentence(sentence);
+        ostringstream buff;
+        for(int i = 0; i < (int)sentence.words.size(); i++)
+            buff << unkUtil->showString(sentence.words[i].surface) << "/"
+                 << unkUtil->showString(sentence.words[i].getTagSurf(0)) << " ";
+        return buff.str();
+    }
+
+    // Train a model that estimates the pronunciation of unknown words
+    Kytea * trainUnkKytea() {
+        ofstream corp("/tmp/kytea-toy-pron.txt");
+        corp << "京都/きょうと に/に 行/い っ/っ た/た 。/。" << endl
+             << "学習/がくしゅう データ/でーた で/で す/す 。/。" << endl;
+        corp.close();
+        ofstream sub("/tmp/kytea-toy-subword.txt");
+        sub << "東/とう" << endl << "京/きょう" << endl << "都/と" << endl
+            << "学/がく" << endl << "習/しゅう" << endl;
+        sub.close();
+        const char* unkCmd[7] = {"", "-model", "/tmp/kytea-unk-model.bin", "-full", "/tmp/kytea-toy-pron.txt", "-subword", "/tmp/kytea-toy-subword.txt"};
+        KyteaConfig * config = new KyteaConfig;
+        config->setDebug(0);
+        config->setOnTraining(true);
+        config->parseTrainCommandLine(7, unkCmd);
+        Kytea * unkKytea = new Kytea(config);
+        unkKytea->trainAll();
+        config->setOnTraining(false);
+        return unkKytea;
+    }
+
+    int testUnkCache() {
+        Kytea * trained = trainUnkKytea();
+        Kytea & unkKytea = *trained;
+        // Analyze a sentence with an unknown word without the cache, and
+        //  twice with it, which must give the same tags
+        const string text = "東京で学習した。";
+        string exp = analyzeUnk(&unkKytea, text);
+        unkKytea.setUnkCacheSize(2);
+        string first = analyzeUnk(&unkKytea, text);
+        unsigned long misses = unkKytea.getUnkCacheMisses();
+        string second = analyzeUnk(&unkKytea, text);
+        int ok = 1;
+        if(first != exp || second != exp) {
+            cerr << "Cached result '"<<first<<"', '"<<second<<"' != '"<<exp<<"'"<<endl;
+            ok = 0;
+        }
+        if(misses == 0 || unkKytea.getUnkCacheMisses() != misses || unkKytea.getUnkCacheHits() != misses) {
+            cerr << "Cache hits "<<unkKytea.getUnkCacheHits()<<" and misses "<<unkKytea.getUnkCacheMisses()
+                 << " after "<<misses<<" misses" << endl;
+            ok = 0;
+        }
+        // The least recently used word is discarded when the cache is full
+        UnkTagCache cache(2);
+        vector<KyteaTag> tags(1, KyteaTag(util->mapString("a"), 1.0)), act;
+        cache.add(UnkTagKey(util->mapString("x"), 0, 50, 3), tags);
+        cache.add(UnkTagKey(util->mapString("y"), 0, 50, 3), tags);
+        cache.find(UnkTagKey(util->mapString("x"), 0, 50, 3), act);
+        cache.add(UnkTagKey(util->mapString("z"), 0, 50, 3), tags);
+        if(cache.size() != 2 || !cache.find(UnkTagKey(util->mapString("x"), 0, 50, 3), act)
+           || cache.find(UnkTagKey(util->mapString("y"), 0, 50, 3), act)
+           || cache.find(UnkTagKey(util->mapString("x"), 1, 50, 3), act) || act != tags) {
+            cerr << "The least recently used entry was not discarded" << endl;
+            ok = 0;
+        }
+        delete trained;
+        return ok;
+    }
+
+    int testLongUnknownWord() {
+        Kytea * unkKytea = trainUnkKytea();
+        StringUtil * unkUtil = unkKytea->getStringUtil();
+        // A word far longer than any in the training data, which must be
+        //  given pronunciations for all of its characters
+        string surf;
+        for(int i = 0; i < 300; i++)
+            surf += "東京学習";
+        KyteaString str = unkUtil->mapString(surf);
+        KyteaWord word(str, unkUtil->normalize(str));
+        unkKytea->calculateUnknownTag(word, 0);
+        int ok = 1;
+        if(word.getNumTags() == 0 || word.tags[0].size() == 0 || word.tags[0].size() > unkKytea->getConfig()->getTagMax()) {
+            cerr << "Bad number of tags for the long unknown word" << endl;
+            ok = 0;
+        } else {
+            for(unsigned i = 0; i < word.tags[0].size(); i++) {
+                if(word.tags[0][i].first.length() < 2*str.length()) {
+                    cerr << "Tag " << i << " is too short (" << word.tags[0][i].first.length() << ")" << endl;
+                    ok = 0;
+                }
+            }
+        }
+        delete unkKytea;
+        return ok;
+    }
+
     bool runTest() {
         int done = 0, succeeded = 0;
         done++; cout << "testWordSegmentationSVM()" << endl; if(testWordSegmentationSVM()) succeeded++; else cout << "FAILED!!!" << endl;
@@ -400,7 +781,17 @@ public:
         done++; cout << "testPartialSegmentation()" << endl; if(testPartialSegmentation()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testTextIO()" << endl; if(testTextIO()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testBinaryIO()" << endl; if(testBinaryIO()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testMappedIO()" << endl; if(testMappedIO()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testConfidentInput()" << endl; if(testConfidentInput()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testTagsAfterConfidentWord()" << endl; if(testTagsAfterConfidentWord()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testConstAnalysis()" << endl; if(testConstAnalysis()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testParallelAnalysis()" << endl; if(testParallelAnalysis()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testParallelTraining()" << endl; if(testParallelTraining()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testStreamingTraining()" << endl; if(testStreamingTraining()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testBinaryFeatures()" << endl; if(testBinaryFeatures()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testHyperparameterSweep()" << endl; if(testHyperparameterSweep()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testUnkCache()" << endl; if(testUnkCache()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testLongUnknownWord()" << endl; if(testLongUnknownWord()) succeeded++; else cout << "FAILED!!!" << endl;
         cout << "#### TestAnalysis Finished with "<<succeeded<<"/"<<done<<" tests succeeding ####"<<endl;
         return done == succeeded;
     }
@@ -177,6 +177,64 @@ public:
         return 1;
     }
 
+    int testReadLines() {
+        // an empty line, a long line, and a final line without a newline,
+        // which is not returned (as with getline)
+        string longLine(100000, 'a');
+        stringstream instr;
+        instr << "右/左" << endl << endl << longLine << endl << "最後";
+        RawCorpusIO io(util, instr, false);
+        vector<KyteaString> exp;
+        exp.push_back(util->mapString("右/左"));
+        exp.push_back(util->mapString(""));
+        exp.push_back(util->mapString(longLine));
+        int ret = 1;
+        for(unsigned i = 0; i < exp.size(); i++) {
+            KyteaSentence * sent = io.readSentence();
+            if(sent == 0 || sent->surface != exp[i]) {
+                cerr << "Bad line "<<i<<endl;
+                ret = 0;
+            }
+            if(sent) delete sent;
+        }
+        KyteaSentence * last = io.readSentence();
+        if(last != 0) {
+            cerr << "Read an unterminated line: "<<util->showString(last->surface)<<endl;
+            delete last;
+            ret = 0;
+        }
+        return ret;
+    }
+
+    int testBufferedOutput() {
+        string input = "これ/代名詞/これ は/助詞/は 未知/名詞/みち\n";
+        stringstream instr;
+        instr << input << input;
+        FullCorpusIO infcio(util, instr, false);
+        KyteaSentence * first = infcio.readSentence();
+        KyteaSentence * second = infcio.readSentence();
+        stringstream outstr;
+        FullCorpusIO outfcio(util, outstr, true);
+        outfcio.setFlushEach(false);
+        outfcio.writeSentence(first);
+        outfcio.writeSentence(second);
+        delete first;
+        delete second;
+        // nothing is written until the output is flushed
+        int ret = 1;
+        if(outstr.str() != "") {
+            cerr << "Output was written before flushing: "<<outstr.str()<<endl;
+            ret = 0;
+        }
+        outfcio.flush();
+        string act = outstr.str();
+        if(act != input + input) {
+            cerr << "exp: "<<input<<input<<endl<<"act: "<<act<<endl;
+            ret = 0;
+        }
+        return ret;
+    }
+
     bool runTest() {
         int done = 0, succeeded = 0;
         done++; cout << "testWordSegConf()" << endl; if(testWordSegConf()) succeeded++; else cout << "FAILED!!!" << endl;
@@ -185,6 +243,8 @@ public:
         done++; cout << "testFullTagConf()" << endl; if(testFullTagConf()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testLastValue()" << endl; if(testLastValue()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testUnkIO()" << endl; if(testUnkIO()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testReadLines()" << endl; if(testReadLines()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testBufferedOutput()" << endl; if(testBufferedOutput()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testTagIO()" << endl; if(testTagIO()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testTokReadSentence()" << endl; if(testTokReadSentence()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testRawReadSlash()" << endl; if(testRawReadSlash()) succeeded++; else cout << "FAILED!!!" << endl;
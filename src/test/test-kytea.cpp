@@ -15,7 +15,9 @@
 */
 
 #include <kytea/feature-lookup.h>
+#include <kytea/feature-kernels.h>
 #include <kytea/kytea-model.h>
+#include <kytea/kytea-lm.h>
 #include <kytea/corpus-io.h>
 #include <kytea/corpus-io-part.h>
 #include <kytea/corpus-io-full.h>
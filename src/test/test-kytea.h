@@ -2,6 +2,7 @@
 #define TEST_KYTEA__
 
 #include <algorithm>
+#include <cmath>
 
 using namespace std;
 
@@ -22,7 +23,240 @@ public:
         }
         return 1;
     }
+
+    int testGetTypeKyteaString() {
+        StringUtilUtf8 util;
+        const StringUtil & constUtil = util;
+        // "K" is a character that is also used as a type letter
+        KyteaString str = util.mapString("漢カひ。１AK");
+        util.freeze();
+        // a character that was added after the table was built
+        KyteaString late = util.mapString("字a");
+        int ret = 1;
+        if(constUtil.getTypeKyteaString(str) != constUtil.mapString(util.getTypeString(str))) {
+            cout << "testGetTypeKyteaString::Mismatch for "<<util.showString(str)<<endl;
+            ret = 0;
+        }
+        if(constUtil.getTypeKyteaString(late) != constUtil.mapString(util.getTypeString(late))) {
+            cout << "testGetTypeKyteaString::Mismatch for "<<util.showString(late)<<endl;
+            ret = 0;
+        }
+        return ret;
+    }
     
+    int testMapUtf8String() {
+        StringUtilUtf8 util;
+        // an ASCII run longer than a block, characters of every length, and
+        // an overlong encoding of "A", which must stay a separate character
+        const char * chars[] = { "a", "b", "c", "d", "e", "f", "g", "h", "i", "A",
+                                 "\xC3\xA9", "漢", "\xF0\xA0\x80\x8B", "\xC1\x81", "A", "j" };
+        const unsigned num = sizeof(chars)/sizeof(chars[0]);
+        string all;
+        for(unsigned i = 0; i < num; i++)
+            all += chars[i];
+        KyteaString str = util.mapString(all);
+        int ret = 1;
+        if(str.length() != num) {
+            cout << "testMapUtf8String::Expected length "<<num<<" but got "<<str.length()<<endl;
+            return 0;
+        }
+        for(unsigned i = 0; i < num; i++) {
+            if(str[i] != util.mapChar(chars[i])) {
+                cout << "testMapUtf8String::Bad character at "<<i<<endl;
+                ret = 0;
+            }
+        }
+        if(util.mapChar("A") == util.mapChar("\xC1\x81")) {
+            cout << "testMapUtf8String::Overlong encoding was merged"<<endl;
+            ret = 0;
+        }
+        // unknown characters map to the reserved ids with the const version
+        const StringUtil & constUtil = util;
+        KyteaString unk = constUtil.mapString("x字");
+        if(unk.length() != 2 || unk[0] != constUtil.mapChar("x") || unk[1] != constUtil.mapChar("字")) {
+            cout << "testMapUtf8String::Bad unknown characters"<<endl;
+            ret = 0;
+        }
+        return ret;
+    }
+
+    int testFeatKernels() {
+        // fill arrays of every length up to 40 with pseudo-random values
+        vector<FeatVal> vals(40);
+        vector<FeatSum> start(40);
+        unsigned seed = 1;
+        for(int i = 0; i < 40; i++) {
+            seed = seed * 1103515245 + 12345;
+            vals[i] = (FeatVal)((int)(seed >> 8) % 30000 - 15000);
+            start[i] = (FeatSum)((int)(seed >> 12) % 1000);
+        }
+        const char * names[] = { "avx2", "sse4.1" };
+        const char * original = featKernels.name;
+        int ret = 1;
+        for(int k = 0; k < 2; k++) {
+            if(!setFeatKernels(names[k]))
+                continue;
+            for(int n = 0; n <= 40; n++) {
+                vector<FeatSum> exp(start.begin(), start.begin()+n), act = exp;
+                for(int i = 0; i < n; i++)
+                    exp[i] += vals[i];
+                featKernels.add(act.data(), vals.data(), n);
+                if(exp != act) {
+                    cout << "testFeatKernels::Mismatch for "<<names[k]<<" at length "<<n<<endl;
+                    ret = 0;
+                }
+            }
+        }
+        setFeatKernels(original);
+        return ret;
+    }
+
+    int testKyteaString() {
+        StringUtilUtf8 util;
+        KyteaString shortStr = util.mapString("漢字"), longStr = util.mapString("漢字かなカナ交じり");
+        int ret = 1;
+        // Copies of long strings share their characters until one is changed
+        KyteaString copy = longStr;
+        if(copy.getChars() != longStr.getChars()) {
+            cout << "testKyteaString::Long copy does not share its characters" << endl;
+            ret = 0;
+        }
+        copy[0] = shortStr[1];
+        if(copy.getChars() == longStr.getChars() || longStr != util.mapString("漢字かなカナ交じり")) {
+            cout << "testKyteaString::Changing a copy changed the original" << endl;
+            ret = 0;
+        }
+        // Short strings are stored inline, and equal to the same long substring
+        KyteaString inlineCopy = shortStr;
+        inlineCopy[0] = shortStr[1];
+        if(shortStr != longStr.substr(0, 2) || inlineCopy == shortStr
+           || shortStr.getHash() != longStr.substr(0, 2).getHash()) {
+            cout << "testKyteaString::Bad short string" << endl;
+            ret = 0;
+        }
+        // Strings that cross the inline length when concatenated
+        KyteaString joined = shortStr + shortStr + shortStr;
+        if(joined != util.mapString("漢字漢字漢字") || joined.substr(4) != shortStr) {
+            cout << "testKyteaString::Bad concatenation " << util.showString(joined) << endl;
+            ret = 0;
+        }
+        // Moving leaves the source empty
+        KyteaString moved(std::move(copy)), movedShort;
+        movedShort = std::move(inlineCopy);
+        if(copy.length() != 0 || inlineCopy.length() != 0
+           || moved.length() != longStr.length() || movedShort.length() != 2) {
+            cout << "testKyteaString::Bad move" << endl;
+            ret = 0;
+        }
+        // Views compare and hash like the strings that they point into
+        KyteaStringView view(longStr, 2, 4);
+        if(view != longStr.substr(2, 4) || view.str() != longStr.substr(2, 4)
+           || view.substr(2, 2) != util.mapString("カナ")
+           || KyteaStringHash()(view) != KyteaStringHash()(longStr.substr(2, 4))) {
+            cout << "testKyteaString::Bad view " << util.showString(view.str()) << endl;
+            ret = 0;
+        }
+        return ret;
+    }
+
+    int testLocalFeatureMap() {
+        StringUtilUtf8 util;
+        const char* parts[2][3] = { { "b", "a", "c" }, { "c", "d", "b" } };
+        // the model that maps all of the features in order
+        KyteaModel exp, act;
+        exp.mapFeat(util.mapString("a"));
+        act.mapFeat(util.mapString("a"));
+        vector<unsigned> expIds;
+        for(int p = 0; p < 2; p++)
+            for(int i = 0; i < 3; i++)
+                expIds.push_back(exp.mapFeat(util.mapString(parts[p][i])));
+        // map the parts separately, then add them in order
+        vector<FeatureMatrix> feats(2);
+        vector<LocalFeatureMap> maps(2, LocalFeatureMap(&act));
+        for(int p = 1; p >= 0; p--) {
+            for(int i = 0; i < 3; i++)
+                feats[p].addFeature(maps[p].mapFeat(util.mapString(parts[p][i])));
+            feats[p].endRow();
+        }
+        vector<unsigned> actIds;
+        for(int p = 0; p < 2; p++) {
+            maps[p].addToModel(&act, feats[p]);
+            for(unsigned i = 0; i < feats[p].rowSize(0); i++)
+                actIds.push_back(feats[p].row(0)[i].index);
+        }
+        if(expIds != actIds || exp.getNames() != act.getNames()) {
+            cout << "testLocalFeatureMap::Ids do not match those of the model" << endl;
+            return 0;
+        }
+        return 1;
+    }
+
+    int testFeatureMatrix() {
+        FeatureMatrix xs, ys;
+        vector<unsigned> feats;
+        feats.push_back(3); feats.push_back(1);
+        xs.push_back(feats);
+        xs.push_back(vector<unsigned>());
+        ys.push_back(vector<unsigned>(1, 2));
+        xs.append(ys);
+        xs.setBias(5, 1);
+        if(xs.size() != 3 || xs.getNumFeatures() != 3 || xs.rowSize(0) != 2 || xs.rowSize(1) != 0 || xs.rowSize(2) != 1) {
+            cout << "testFeatureMatrix::Sizes do not match" << endl;
+            return 0;
+        }
+        // every row ends with the bias and a terminator
+        const int expIdx[3][4] = { { 3, 1, 5, -1 }, { 5, -1 }, { 2, 5, -1 } };
+        int ok = 1;
+        for(unsigned i = 0; i < xs.size(); i++)
+            for(unsigned j = 0; j < xs.rowSize(i)+2; j++)
+                if(xs.row(i)[j].index != expIdx[i][j])
+                    ok = 0;
+        if(xs.row(2)[1].value != 1 || xs.row(2)[2].value != 0)
+            ok = 0;
+        xs.setBias(5, -1);
+        if(xs.row(0)[2].index != -1)
+            ok = 0;
+        if(!ok)
+            cout << "testFeatureMatrix::Rows do not match" << endl;
+        return ok;
+    }
+
+    int testPackedLM() {
+        StringUtilUtf8 util;
+        vector<KyteaString> corpus;
+        corpus.push_back(util.mapString("がくしゅう"));
+        corpus.push_back(util.mapString("しゅうがく"));
+        corpus.push_back(util.mapString("がっこう"));
+        corpus.push_back(util.mapString("こうがく"));
+        KyteaLM packed(3);
+        packed.train(corpus);
+        // the same model without the packed tables
+        KyteaLM plain(3);
+        plain.probs_ = packed.probs_;
+        plain.fallbacks_ = packed.fallbacks_;
+        if(!packed.isPacked() || plain.isPacked()) {
+            cout << "testPackedLM::Packed tables were not built as expected" << endl;
+            return 0;
+        }
+        // the values are stored as floats, so allow for the difference
+        const char * strs[] = { "がくしゅう", "しゅうこう", "ぱっく" };
+        int ret = 1;
+        for(int i = 0; i < 3; i++) {
+            KyteaString str = util.mapString(strs[i]);
+            KyteaLMState state = packed.getStartState();
+            for(unsigned pos = 0; pos <= str.length(); pos++) {
+                double exp = plain.scoreSingle(str, pos);
+                double single = packed.scoreSingle(str, pos);
+                double next = packed.scoreNext(state, pos < str.length() ? str[pos] : 0);
+                if(fabs(exp-single) > 1e-5 || fabs(exp-next) > 1e-5) {
+                    cout << "testPackedLM::Scores for "<<strs[i]<<" at "<<pos<<" "<<exp<<" != "<<single<<", "<<next<<endl;
+                    ret = 0;
+                }
+            }
+        }
+        return ret;
+    }
+
     int compareFeatures(vector<KyteaString> & exp, vector<KyteaString> & act, StringUtilUtf8 & util) {
         sort(exp.begin(), exp.end());
         sort(act.begin(), act.end());
@@ -432,14 +666,16 @@ public:
         vector<FeatSum> exp(5,13); // All are inside D1I5 (only once)
         exp[4] += 12; // The last one is to the right of D1L1
         exp[0] += 14; // The last one is to the right of D2R5
-        vector<FeatSum> act(5,0);
+        vector<FeatSum> act(5,0), actVisit(5,0);
         look->addDictionaryScores(dict.match(str), 2, 5, act);
+        look->addDictionaryScores(&dict, str, 2, 5, actVisit);
         // Check that these are equal
         int ret = 1;
         for(int i = 0; i < 5; i++) {
-            if(act[i] != exp[i]) {
+            if(act[i] != exp[i] || actVisit[i] != exp[i]) {
                 cerr 
                     << "act["<<i<<"]="<<act[i]
+                    << " actVisit["<<i<<"]="<<actVisit[i]
                     << " exp["<<i<<"]="<<exp[i] <<endl;
                 ret = 0;
             }
@@ -448,9 +684,70 @@ public:
         return ret;
     }
 
+    int testDictionaryMatch() {
+        StringUtilUtf8 util;
+        // Words that share prefixes and suffixes with each other
+        const int SIZE = 6;
+        const char* wordStrs[SIZE] = { "a", "ab", "bc", "abcd", "cd", "漢ab" };
+        typedef Dictionary<vector<FeatVal> >::WordMap WordMap;
+        WordMap wm;
+        for(int i = 0; i < SIZE; i++)
+            wm.insert(WordMap::value_type(util.mapString(wordStrs[i]),new vector<FeatVal>(1,i)));
+        Dictionary<vector<FeatVal> > dict(&util);
+        dict.buildIndex(wm);
+        int ret = 1;
+        if(dict.findEntry(util.mapString("abc")) != NULL || dict.findEntry(util.mapString("x")) != NULL) {
+            cerr << "Found a word that is not in the dictionary" << endl;
+            ret = 0;
+        }
+        // Every match must be a word ending at that position, and all words
+        // must be found
+        KyteaString str = util.mapString("x漢abcdab");
+        vector< pair<unsigned,FeatVal> > exp, act;
+        for(unsigned end = 0; end < str.length(); end++)
+            for(unsigned start = 0; start <= end; start++) {
+                const vector<FeatVal> * entry = dict.findEntry(str.substr(start, end-start+1));
+                if(entry) exp.push_back(make_pair(end, (*entry)[0]));
+                if(entry != dict.findEntry(KyteaStringView(str, start, end-start+1))) {
+                    cerr << "Lookup of view "<<start<<"-"<<end<<" does not match its substring" << endl;
+                    ret = 0;
+                }
+            }
+        Dictionary<vector<FeatVal> >::MatchResult res = dict.match(str);
+        for(unsigned i = 0; i < res.size(); i++)
+            act.push_back(make_pair(res[i].first, (*res[i].second)[0]));
+        sort(exp.begin(), exp.end());
+        sort(act.begin(), act.end());
+        if(exp.size() != 8 || exp != act) {
+            cerr << "exp.size() == "<<exp.size()<<", act.size() == "<<act.size()<<endl;
+            ret = 0;
+        }
+        // Matching part of the string must give the same result as its copy
+        if(dict.matchIds(KyteaStringView(str, 2, 4)) != dict.matchIds(str.substr(2, 4))) {
+            cerr << "Matches of a view do not match its substring" << endl;
+            ret = 0;
+        }
+        // Matching into a reused buffer must replace its old contents
+        Dictionary<vector<FeatVal> >::MatchIdResult buff(20);
+        dict.matchIds(str, buff);
+        dict.matchIds(str, buff);
+        if(buff.size() != res.size()) {
+            cerr << "buff.size() == "<<buff.size()<<", res.size() == "<<res.size()<<endl;
+            ret = 0;
+        }
+        return ret;
+    }
+
     bool runTest() {
         int done = 0, succeeded = 0;
         done++; cout << "testGetTypeString()" << endl; if(testGetTypeString()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testMapUtf8String()" << endl; if(testMapUtf8String()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testFeatKernels()" << endl; if(testFeatKernels()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testKyteaString()" << endl; if(testKyteaString()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testLocalFeatureMap()" << endl; if(testLocalFeatureMap()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testFeatureMatrix()" << endl; if(testFeatureMatrix()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testPackedLM()" << endl; if(testPackedLM()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testGetTypeKyteaString()" << endl; if(testGetTypeKyteaString()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testWSNgramFeatures()" << endl; if(testWSNgramFeatures()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testTagNgramFeatures()" << endl; if(testTagNgramFeatures()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testTagSelfFeatures()" << endl; if(testTagSelfFeatures()) succeeded++; else cout << "FAILED!!!" << endl;
@@ -460,6 +757,7 @@ public:
         done++; cout << "testWSLookupMatchesModel()" << endl; if(testWSLookupMatchesModel()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testTagLookupMatchesModel()" << endl; if(testTagLookupMatchesModel()) succeeded++; else cout << "FAILED!!!" << endl;
         done++; cout << "testFeatureLookupDictionary()" << endl; if(testFeatureLookupDictionary()) succeeded++; else cout << "FAILED!!!" << endl;
+        done++; cout << "testDictionaryMatch()" << endl; if(testDictionaryMatch()) succeeded++; else cout << "FAILED!!!" << endl;
         cout << "#### TestKytea Finished with "<<succeeded<<"/"<<done<<" tests succeeding ####"<<endl;
         return (done == succeeded);
     }